@@ -0,0 +1,128 @@
+/*
+ * buffers.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <iostream>
+
+#include "buffers.h"
+
+namespace v4l2 {
+
+/** Frames dequeued between decisions */
+static const int kWindowFrames = 300;
+/** Windows without drops before removing a buffer */
+static const int kQuietWindows = 2;
+/** Windows ignored after a change, while the new number settles */
+static const int kCooldownWindows = 2;
+
+/**
+ * Constructor
+ * @param min_buffers lower bound of buffers (at least 2)
+ * @param max_buffers upper bound of buffers
+ * @param fps camera frame rate
+ */
+BufferController::BufferController(int min_buffers, int max_buffers, int fps)
+    : min_buffers_(min_buffers < 2 ? 2 : min_buffers),
+      max_buffers_(max_buffers < min_buffers ? min_buffers : max_buffers),
+      quiet_windows_(0),
+      cooldown_windows_(0) {
+  Reset(fps);
+}
+
+/** Start again after a stream restart (frames are lost meanwhile) */
+void BufferController::Reset(int fps) {
+  frame_period_ = 1000000 / (fps > 0 ? fps : 1);
+  window_frames_ = 0;
+  drops_ = 0;
+  max_hold_ = 0;
+  max_age_ = 0;
+  has_previous_ = false;
+}
+
+/**
+ * Account a frame just dequeued
+ * @param skipped frames requeued unserved along with it (latest frame mode),
+ * which aren't drops
+ */
+void BufferController::OnDequeue(Buffer* frame, long skipped) {
+  long long now = MonotonicTime();
+  /*
+   * Sequence gaps are drops, and waiting frames a backlog, only if the
+   * consumer kept asking for frames; while nobody asks, queues fill up and
+   * the driver skips frames anyway
+   */
+  bool asking = has_previous_ && now - release_time_ < 2 * frame_period_;
+  if (asking && frame->sequence > last_sequence_ + 1 + skipped) {
+    drops_ += frame->sequence - last_sequence_ - 1 - skipped;
+  }
+  if (asking && FrameAge(frame) > max_age_) {
+    max_age_ = FrameAge(frame);
+  }
+  last_sequence_ = frame->sequence;
+  dequeue_time_ = now;
+  window_frames_++;
+}
+
+/** Account release of last dequeued frame */
+void BufferController::OnRelease() {
+  release_time_ = MonotonicTime();
+  has_previous_ = true;
+  if (release_time_ - dequeue_time_ > max_hold_) {
+    max_hold_ = release_time_ - dequeue_time_;
+  }
+}
+
+/**
+ * Choose number of buffers at the end of each window
+ * A buffer is added when frames were dropped. One is removed after some
+ * windows without drops, if the longest hold time shows it isn't needed:
+ * the driver fills one buffer while the consumer holds another, plus those
+ * needed to cover the hold time, and one more is kept as margin. Hold time
+ * misses bursts of work between frames: frames waiting over a frame period
+ * at dequeue show a backlog held in the queue, so no buffer is removed.
+ * (Frames with timestamps not from the monotonic clock look always old,
+ * which only keeps buffers.)
+ * @param current number of buffers in use
+ * @return wanted number of buffers
+ */
+int BufferController::Decide(int current) {
+  if (window_frames_ < kWindowFrames) {
+    return current;
+  }
+  int required = 2 + (int) ((max_hold_ + frame_period_ - 1) / frame_period_);
+  int wanted = current;
+  if (cooldown_windows_ > 0) {
+    cooldown_windows_--;
+    quiet_windows_ = 0;
+  } else if (drops_ > 0) {
+    quiet_windows_ = 0;
+    if (current < max_buffers_) {
+      wanted = current + 1;
+    }
+  } else if (max_age_ > frame_period_) {
+    quiet_windows_ = 0;
+  } else if (++quiet_windows_ >= kQuietWindows && required < current - 1
+      && current > min_buffers_) {
+    quiet_windows_ = 0;
+    wanted = current - 1;
+  }
+  if (wanted != current) {
+    cooldown_windows_ = kCooldownWindows;
+  }
+  std::cout << "Buffers: " << current << " -> " << wanted << " (" << drops_
+            << " drops in " << window_frames_ << " frames, max hold "
+            << max_hold_ / 1000.0 << " ms, max age " << max_age_ / 1000.0
+            << " ms, required " << required
+            << ", bounds " << min_buffers_ << "-" << max_buffers_ << ")"
+            << std::endl;
+  window_frames_ = 0;
+  drops_ = 0;
+  max_hold_ = 0;
+  max_age_ = 0;
+  return wanted;
+}
+
+} /* namespace */
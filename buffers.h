@@ -0,0 +1,57 @@
+/*
+ * buffers.h
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#ifndef JDEROBOT_COMPONENTS_V4L2SERVER_BUFFERS_H_
+#define JDEROBOT_COMPONENTS_V4L2SERVER_BUFFERS_H_
+
+#include "v4l2.h"
+
+namespace v4l2 {
+
+/**
+ * Adaptive number of capture buffers
+ * Watches frames dropped by the driver, how long frames waited in the queue
+ * and how long the consumer holds them, and chooses the minimum number of
+ * buffers that keeps drops at zero.
+ * Decisions are taken once per window of frames; changing the number of
+ * buffers needs a stream restart, which is up to the caller. After a change
+ * no other one is taken for some windows, and a buffer is removed only if one
+ * spare buffer is left, so the number of buffers doesn't oscillate.
+ */
+class BufferController {
+ private:
+  int min_buffers_;
+  int max_buffers_;
+  /** Frame period in microseconds */
+  long long frame_period_;
+  /** Statistics of current window */
+  int window_frames_;
+  int drops_;
+  long long max_hold_;
+  /** Longest time a frame waited in the queue while the consumer asked */
+  long long max_age_;
+  /** Consecutive windows without drops */
+  int quiet_windows_;
+  /** Windows left before next change is allowed */
+  int cooldown_windows_;
+  /** Last dequeued frame */
+  bool has_previous_;
+  unsigned int last_sequence_;
+  long long dequeue_time_;
+  long long release_time_;
+
+ public:
+  BufferController(int min_buffers, int max_buffers, int fps);
+  void Reset(int fps);
+  void OnDequeue(Buffer* frame, long skipped = 0);
+  void OnRelease();
+  int Decide(int current);
+};
+
+} /* namespace */
+
+#endif /* JDEROBOT_COMPONENTS_V4L2SERVER_BUFFERS_H_ */
@@ -0,0 +1,124 @@
+/*
+ * compression.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <iostream>
+
+#include "compression.h"
+
+namespace cameraserver {
+
+/** Number of encoded frames between metrics reports */
+static const long kMetricsReportPeriod = 100;
+
+CompressionStage::CompressionStage()
+    : cachedSequence(-1),
+      encodedFrames(0),
+      encodedBytes(0),
+      encodeMicroseconds(0),
+      lastBytes(0),
+      lastMicroseconds(0) {
+}
+
+/**
+ * Get JPEG version of a YUYV frame, encoding it only once per quality
+ * @param frame YUYV frame dequeued from camera
+ * @param format image size of frame
+ * @param quality JPEG quality (1-100)
+ * @param statistics if not NULL, filled while encoding (not when cached)
+ * @return image data ready to be sent to clients
+ */
+jderobot::ImageDataPtr CompressionStage::compress(
+    v4l2::Buffer* frame, v4l2::Format* format, int quality,
+    v4l2::FrameStatistics* statistics) throw (std::string) {
+  if ((long long) frame->sequence != cachedSequence) {
+    cache.clear();
+    cachedSequence = frame->sequence;
+  }
+  std::map<int, jderobot::ImageDataPtr>::iterator cached = cache.find(quality);
+  if (cached != cache.end()) {
+    return cached->second;
+  }
+
+  jderobot::ImageDataPtr image(new jderobot::ImageData);
+  image->description = new jderobot::ImageDescription();
+  image->description->width = format->width;
+  image->description->height = format->height;
+  image->description->format = "JPEG";
+  /* Previous size is a good guess to avoid growing output while encoding */
+  image->pixelData.reserve(lastBytes + lastBytes / 4);
+
+  IceUtil::Time start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+  size_t size = encoder.Encode(frame, format, quality, &image->pixelData,
+                               statistics);
+  IceUtil::Time elapsed = IceUtil::Time::now(IceUtil::Time::Monotonic)
+      - start;
+  image->description->size = size;
+  cache[quality] = image;
+
+  IceUtil::Mutex::Lock sync(metricsMutex);
+  encodedFrames++;
+  encodedBytes += size;
+  encodeMicroseconds += elapsed.toMicroSeconds();
+  lastBytes = size;
+  lastMicroseconds = elapsed.toMicroSeconds();
+  if (encodedFrames % kMetricsReportPeriod == 0) {
+    std::cout << "JPEG: " << encodedFrames << " frames, "
+              << encodedBytes / encodedFrames << " bytes/frame, "
+              << encodeMicroseconds / encodedFrames << " us/frame (last "
+              << lastBytes << " bytes, " << lastMicroseconds << " us)"
+              << std::endl;
+  }
+  return image;
+}
+
+/**
+ * Image of frame already encoded at quality
+ * @return NULL if it wasn't encoded yet
+ */
+jderobot::ImageDataPtr CompressionStage::cached(v4l2::Buffer* frame,
+                                                int quality) {
+  if ((long long) frame->sequence != cachedSequence) {
+    return 0;
+  }
+  std::map<int, jderobot::ImageDataPtr>::iterator image = cache.find(quality);
+  if (image == cache.end()) {
+    return 0;
+  }
+  return image->second;
+}
+
+/** Drop cached images (as when image size changes) */
+void CompressionStage::invalidate() {
+  cache.clear();
+  cachedSequence = -1;
+}
+
+/** Number of frames encoded */
+long CompressionStage::encoded() {
+  IceUtil::Mutex::Lock sync(metricsMutex);
+  return encodedFrames;
+}
+
+/** Size in bytes of last encoded frame */
+size_t CompressionStage::lastSize() {
+  IceUtil::Mutex::Lock sync(metricsMutex);
+  return lastBytes;
+}
+
+/** Mean size in bytes of encoded frames */
+double CompressionStage::meanSize() {
+  IceUtil::Mutex::Lock sync(metricsMutex);
+  return encodedFrames ? (double) encodedBytes / encodedFrames : 0;
+}
+
+/** Mean encoding time in microseconds */
+double CompressionStage::meanEncodeTime() {
+  IceUtil::Mutex::Lock sync(metricsMutex);
+  return encodedFrames ? (double) encodeMicroseconds / encodedFrames : 0;
+}
+
+}  //namespace
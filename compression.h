@@ -0,0 +1,57 @@
+/*
+ * compression.h
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#ifndef JDEROBOT_COMPONENTS_COMPRESSION_H_
+#define JDEROBOT_COMPONENTS_COMPRESSION_H_
+
+#include <IceUtil/IceUtil.h>
+#include <map>
+
+#include <jderobot/image.h>
+
+#include "jpeg.h"
+#include "v4l2.h"
+
+namespace cameraserver {
+
+/**
+ * Server side JPEG compression of YUYV frames
+ * Encoded images are cached for the current frame, so all clients asking for
+ * the same quality share a single encode.
+ */
+class CompressionStage {
+ private:
+  v4l2::JpegEncoder encoder;
+  /** Sequence number of the frame held in cache (-1 if none) */
+  long long cachedSequence;
+  /** Encoded images of cached frame indexed by quality */
+  std::map<int, jderobot::ImageDataPtr> cache;
+  /** Metrics */
+  IceUtil::Mutex metricsMutex;
+  long encodedFrames;
+  long encodedBytes;
+  long encodeMicroseconds;
+  size_t lastBytes;
+  long lastMicroseconds;
+
+ public:
+  CompressionStage();
+  jderobot::ImageDataPtr compress(v4l2::Buffer* frame, v4l2::Format* format,
+                                  int quality,
+                                  v4l2::FrameStatistics* statistics = NULL)
+                                      throw (std::string);
+  jderobot::ImageDataPtr cached(v4l2::Buffer* frame, int quality);
+  void invalidate();
+  long encoded();
+  size_t lastSize();
+  double meanSize();
+  double meanEncodeTime();
+};
+
+}
+
+#endif /* JDEROBOT_COMPONENTS_COMPRESSION_H_ */
@@ -0,0 +1,154 @@
+/*
+ * group.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/poll.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include "group.h"
+
+namespace v4l2 {
+
+static long long Timestamp(Buffer* frame) {
+  return (long long) frame->timestamp.tv_sec * 1000000
+      + frame->timestamp.tv_usec;
+}
+
+/**
+ * Constructor
+ * @param cameras started cameras of the group
+ * @param tolerance maximum timestamp difference in a set (microseconds)
+ * @param max_age frames older than this when dequeued are discarded
+ * (microseconds, 0 keeps every frame)
+ */
+CameraGroup::CameraGroup(std::vector<Camera*> cameras, long long tolerance,
+                         long long max_age)
+    : cameras_(cameras),
+      frames_(cameras.size(), (Buffer*) NULL),
+      tolerance_(tolerance),
+      max_age_(max_age),
+      matched_sets_(0),
+      dropped_frames_(0),
+      stale_frames_(0),
+      total_skew_(0),
+      max_skew_(0) {
+}
+
+/**
+ * Wait until every camera has a frame within tolerance of the others
+ * @param milliseconds maximum time waiting
+ * @param frames matched set, one frame per camera in group order
+ * @return false on timeout
+ */
+bool CameraGroup::WaitFrames(int milliseconds, std::vector<Buffer*>* frames)
+    throw (std::string) {
+  long long deadline = MonotonicTime() + (long long) milliseconds * 1000;
+  std::vector<struct pollfd> ufds(cameras_.size());
+  std::vector<int> polled(cameras_.size());
+  while (true) {
+    /* Wait only for cameras still missing a frame */
+    int num_fds = 0;
+    for (size_t i = 0; i < cameras_.size(); i++) {
+      if (frames_[i] == NULL) {
+        ufds[num_fds].fd = cameras_[i]->fd();
+        ufds[num_fds].events = POLLIN;
+        ufds[num_fds].revents = 0;
+        polled[num_fds++] = i;
+      }
+    }
+    if (num_fds > 0) {
+      long long remaining = deadline - MonotonicTime();
+      if (remaining <= 0) {
+        return false;
+      }
+      int result = poll(&ufds[0], num_fds, (int) (remaining / 1000));
+      if (result == -1) {
+        std::ostringstream output_message;
+        output_message << "(CameraGroup) Error waiting for devices: ["
+                       << errno << "] " << strerror(errno);
+        throw std::string(output_message.str());
+      }
+      for (int fd = 0; fd < num_fds; fd++) {
+        if (!(ufds[fd].revents & POLLIN)) {
+          continue;
+        }
+        Buffer* frame = cameras_[polled[fd]]->WaitFrame(0);
+        if (frame != NULL && max_age_ > 0 && FrameAge(frame) > max_age_) {
+          cameras_[polled[fd]]->FreeFrame(frame);
+          stale_frames_++;
+          frame = NULL;
+        }
+        frames_[polled[fd]] = frame;
+      }
+      continue;
+    }
+    /* Every camera has a frame: drop those too old for newest one */
+    long long newest = Timestamp(frames_[0]);
+    long long oldest = newest;
+    for (size_t i = 1; i < frames_.size(); i++) {
+      newest = std::max(newest, Timestamp(frames_[i]));
+      oldest = std::min(oldest, Timestamp(frames_[i]));
+    }
+    bool dropped = false;
+    for (size_t i = 0; i < frames_.size(); i++) {
+      if (newest - Timestamp(frames_[i]) > tolerance_) {
+        cameras_[i]->FreeFrame(frames_[i]);
+        frames_[i] = NULL;
+        dropped_frames_++;
+        dropped = true;
+      }
+    }
+    if (dropped) {
+      continue;
+    }
+    matched_sets_++;
+    total_skew_ += newest - oldest;
+    max_skew_ = std::max(max_skew_, newest - oldest);
+    *frames = frames_;
+    return true;
+  }
+}
+
+/** Give back to drivers the frames of last matched set */
+void CameraGroup::FreeFrames() throw (std::string) {
+  for (size_t i = 0; i < frames_.size(); i++) {
+    if (frames_[i] != NULL) {
+      cameras_[i]->FreeFrame(frames_[i]);
+      frames_[i] = NULL;
+    }
+  }
+}
+
+/** Number of sets matched */
+long CameraGroup::matched_sets() {
+  return matched_sets_;
+}
+
+/** Number of frames dropped for lack of a match */
+long CameraGroup::dropped_frames() {
+  return dropped_frames_;
+}
+
+/** Number of frames discarded for being too old when dequeued */
+long CameraGroup::stale_frames() {
+  return stale_frames_;
+}
+
+/** Mean timestamp difference in matched sets (microseconds) */
+double CameraGroup::mean_skew() {
+  return matched_sets_ ? (double) total_skew_ / matched_sets_ : 0;
+}
+
+/** Maximum timestamp difference in matched sets (microseconds) */
+long long CameraGroup::max_skew() {
+  return max_skew_;
+}
+
+} /* namespace */
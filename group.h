@@ -0,0 +1,56 @@
+/*
+ * group.h
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#ifndef JDEROBOT_COMPONENTS_V4L2SERVER_GROUP_H_
+#define JDEROBOT_COMPONENTS_V4L2SERVER_GROUP_H_
+
+#include <vector>
+
+#include "v4l2.h"
+
+namespace v4l2 {
+
+/**
+ * Cameras captured together (stereo rigs)
+ * Frames of every camera are dequeued in a single poll loop and matched by
+ * V4L2 timestamp: a set is returned when all frames are within tolerance,
+ * older frames being dropped until that happens. Cameras are only dequeued
+ * while someone waits for a set, so frames already too old when dequeued
+ * (queued while nobody asked) are discarded before matching.
+ */
+class CameraGroup {
+ private:
+  std::vector<Camera*> cameras_;
+  /** Frame held for each camera while looking for a match */
+  std::vector<Buffer*> frames_;
+  /** Maximum timestamp difference in a set (microseconds) */
+  long long tolerance_;
+  /** Maximum frame age when dequeued (microseconds, 0 for any) */
+  long long max_age_;
+  /** Metrics */
+  long matched_sets_;
+  long dropped_frames_;
+  long stale_frames_;
+  long long total_skew_;
+  long long max_skew_;
+
+ public:
+  CameraGroup(std::vector<Camera*> cameras, long long tolerance,
+              long long max_age = 0);
+  bool WaitFrames(int milliseconds, std::vector<Buffer*>* frames)
+      throw (std::string);
+  void FreeFrames() throw (std::string);
+  long matched_sets();
+  long dropped_frames();
+  long stale_frames();
+  double mean_skew();
+  long long max_skew();
+};
+
+} /* namespace */
+
+#endif /* JDEROBOT_COMPONENTS_V4L2SERVER_GROUP_H_ */
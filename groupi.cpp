@@ -0,0 +1,232 @@
+/*
+ * groupi.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <Ice/Ice.h>
+#include <stdlib.h>
+#include <map>
+#include <sstream>
+
+#include "groupi.h"
+#include "imagei.h"
+
+namespace cameraserver {
+
+/** Maximum time waiting for a set of frames before failing requests (ms) */
+static const int kSetTimeout = 2000;
+/** Number of matched sets between metrics reports */
+static const long kMetricsReportPeriod = 100;
+
+/**
+ * Constructor
+ * Fails if any camera of the group can't be started, as no set could be
+ * matched without it.
+ */
+CameraGroupI::CameraGroupI(std::string propertyPrefix,
+                           Ice::CommunicatorPtr ic) throw (std::string)
+    : prefix(propertyPrefix),
+      format(new v4l2::Format()),
+      group(NULL) {
+
+  std::cout << "Constructor CameraGroupI -> " << propertyPrefix << std::endl;
+
+  Ice::PropertiesPtr prop = ic->getProperties();
+
+  format->format = "YUYV";
+  format->width = prop->getPropertyAsIntWithDefault(prefix + "ImageWidth",
+                                                    320);
+  format->height = prop->getPropertyAsIntWithDefault(prefix + "ImageHeight",
+                                                     240);
+  format->fps = prop->getPropertyAsIntWithDefault(prefix + "fps", 10);
+  defaultFormat = prop->getPropertyWithDefault(prefix + "Format", "RGB8");
+  jpegQuality = prop->getPropertyAsIntWithDefault(prefix + "JpegQuality", 75);
+  /* Default tolerance is half a frame period */
+  int tolerance = prop->getPropertyAsIntWithDefault(
+      prefix + "Tolerance", 500 / (format->fps > 0 ? format->fps : 1));
+
+  /* Devices of the group, comma separated */
+  std::istringstream uris(prop->getProperty(prefix + "Uris"));
+  std::string device_name;
+  while (std::getline(uris, device_name, ',')) {
+    if (device_name.empty()) {
+      continue;
+    }
+    std::cout << "Group device name: " << device_name << std::endl;
+    device_names.push_back(device_name);
+    v4l2::Camera* camera = v4l2::NewCamera(device_name, format,
+                                           format->fps);
+    cameras.push_back(camera);
+    compression.push_back(new CompressionStage());
+    try {
+      camera->Open();
+      camera->Initialize();
+      camera->Start();
+    } catch (std::string& e) {
+      for (size_t i = 0; i < cameras.size(); i++) {
+        delete cameras[i];
+        delete compression[i];
+      }
+      throw std::string("(CameraGroupI) " + device_name + ": " + e);
+    }
+    formats.push_back(camera->format());
+  }
+  if (cameras.empty()) {
+    throw std::string("(CameraGroupI) No devices in " + prefix + "Uris");
+  }
+  /* Frames queued over two frame periods ago are stale */
+  long long maxAge = 2000000LL / (format->fps > 0 ? format->fps : 1);
+  group = new v4l2::CameraGroup(cameras, (long long) tolerance * 1000,
+                                maxAge);
+
+  replyTask = new GroupReplyTask(this);
+  replyTask->start();
+}
+
+CameraGroupI::~CameraGroupI() {
+}
+
+void CameraGroupI::getImageSet_async(
+    const v4l2server::AMD_CameraGroup_getImageSetPtr& cb,
+    const std::string& setFormat, const Ice::Current& c) {
+  std::string requestedFormat = setFormat.empty() ? defaultFormat : setFormat;
+  if (!supportedFormat(requestedFormat)) {
+    jderobot::DataNotExistException ex;
+    ex.what = "Unsupported image format " + requestedFormat;
+    cb->ice_exception(ex);
+    return;
+  }
+  int quality = atoi(contextValue(c, "quality", "0").c_str());
+  if (quality < 1 || quality > 100) {
+    quality = jpegQuality;
+  }
+  replyTask->pushJob(cb, requestedFormat, quality);
+}
+
+
+GroupReplyTask::GroupReplyTask(CameraGroupI* group) {
+  mygroup = group;
+}
+
+void GroupReplyTask::pushJob(
+    const v4l2server::AMD_CameraGroup_getImageSetPtr& cb,
+    const std::string& format, int quality) {
+  IceUtil::Monitor<IceUtil::Mutex>::Lock sync(requestsMonitor);
+  ImageSetRequest request;
+  request.cb = cb;
+  request.format = format;
+  request.quality = quality;
+  requests.push_back(request);
+  requestsMonitor.notify();
+}
+
+/** Build image of a camera frame in requested format */
+jderobot::ImageDataPtr GroupReplyTask::convert(int camera,
+                                               v4l2::Buffer* frame,
+                                               const std::string& format,
+                                               int quality)
+                                                   throw (std::string) {
+  v4l2::Format* cameraFormat = &mygroup->formats[camera];
+  if (format == "JPEG") {
+    return mygroup->compression[camera]->compress(frame, cameraFormat,
+                                                  quality);
+  }
+  jderobot::ImageDataPtr image(new jderobot::ImageData);
+  image->description = new jderobot::ImageDescription();
+  image->description->width = cameraFormat->width;
+  image->description->height = cameraFormat->height;
+  image->description->format = format;
+  if (format == "YUYV") {
+    unsigned char* data = (unsigned char*) frame->mem;
+    image->pixelData.assign(data, data + frame->size);
+  } else {
+    image->pixelData.resize(cameraFormat->width * cameraFormat->height * 3);
+    mygroup->cameras[camera]->YuyvToRgb24(frame, &image->pixelData[0],
+                                          image->pixelData.size());
+  }
+  image->description->size = image->pixelData.size();
+  return image;
+}
+
+void GroupReplyTask::run() {
+  while (1) {
+    std::list<ImageSetRequest> pending;
+    {  //critical region start
+      IceUtil::Monitor<IceUtil::Mutex>::Lock sync(requestsMonitor);
+      while (requests.empty()) {
+        requestsMonitor.wait();
+      }
+      pending.swap(requests);
+    }
+
+    std::vector<v4l2::Buffer*> frames;
+    std::string error;
+    try {
+      if (!mygroup->group->WaitFrames(kSetTimeout, &frames)) {
+        error = "Timeout waiting for a matched set of frames";
+      }
+    } catch (std::string& e) {
+      error = e;
+    }
+    if (!error.empty()) {
+      jderobot::HardwareFailedException ex;
+      ex.what = error;
+      std::cout << "ERROR: " << ex.what << std::endl;
+      while (!pending.empty()) {
+        pending.front().cb->ice_exception(ex);
+        pending.pop_front();
+      }
+      continue;
+    }
+
+    /* Every format (and JPEG quality) is converted only once per set */
+    std::map<std::pair<std::string, int>, v4l2server::FrameSeq> sets;
+    while (!pending.empty()) {
+      ImageSetRequest& request = pending.front();
+      v4l2server::FrameSeq& set = sets[std::make_pair(
+          request.format, request.format == "JPEG" ? request.quality : 0)];
+      try {
+        for (size_t camera = set.size(); camera < frames.size(); camera++) {
+          v4l2server::Frame frame;
+          frame.sequenceNumber = frames[camera]->sequence;
+          frame.image = convert(camera, frames[camera], request.format,
+                                request.quality);
+          frame.image->timeStamp = captureTime(frames[camera]->timestamp);
+          set.push_back(frame);
+        }
+      } catch (std::string& e) {
+        set.clear();
+        jderobot::HardwareFailedException ex;
+        ex.what = e;
+        request.cb->ice_exception(ex);
+        pending.pop_front();
+        continue;
+      }
+      /* Whole set marshaled in a single reply */
+      request.cb->ice_response(set);
+      pending.pop_front();
+    }
+    try {
+      mygroup->group->FreeFrames();
+    } catch (std::string& e) {
+      std::cout << "ERROR: " << e << std::endl;
+    }
+
+    v4l2::CameraGroup* group = mygroup->group;
+    if (group->matched_sets() % kMetricsReportPeriod == 0) {
+      long frames_captured = group->matched_sets() * frames.size()
+          + group->dropped_frames();
+      std::cout << "Group: " << group->matched_sets() << " sets, skew "
+                << group->mean_skew() / 1000.0 << " ms mean, "
+                << group->max_skew() / 1000.0 << " ms max, "
+                << group->dropped_frames() << " frames dropped ("
+                << group->dropped_frames() * 100.0 / frames_captured << "%), "
+                << group->stale_frames() << " stale frames discarded"
+                << std::endl;
+    }
+  }
+}
+
+}  //namespace
@@ -0,0 +1,76 @@
+/*
+ * groupi.h
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#ifndef JDEROBOT_COMPONENTS_GROUPI_H_
+#define JDEROBOT_COMPONENTS_GROUPI_H_
+
+#include <IceUtil/IceUtil.h>
+#include <list>
+#include <vector>
+
+#include "capture.h"
+#include "compression.h"
+#include "group.h"
+#include "synthetic.h"
+#include "v4l2.h"
+
+namespace cameraserver {
+
+class GroupReplyTask;
+class CameraGroupI;
+
+/** Pending getImageSet call and the image format requested by client */
+struct ImageSetRequest {
+  v4l2server::AMD_CameraGroup_getImageSetPtr cb;
+  std::string format;
+  int quality;
+};
+
+class GroupReplyTask : public IceUtil::Thread {
+ private:
+  CameraGroupI* mygroup;
+  IceUtil::Monitor<IceUtil::Mutex> requestsMonitor;
+  std::list<ImageSetRequest> requests;
+
+  jderobot::ImageDataPtr convert(int camera, v4l2::Buffer* frame,
+                                 const std::string& format, int quality)
+                                     throw (std::string);
+
+ public:
+  GroupReplyTask(CameraGroupI* group);
+  void pushJob(const v4l2server::AMD_CameraGroup_getImageSetPtr& cb,
+               const std::string& format, int quality);
+  virtual void run();
+};
+
+class CameraGroupI : virtual public v4l2server::CameraGroup {
+
+ public:
+
+  std::string prefix;
+  std::vector<std::string> device_names;
+  v4l2::Format* format;
+  std::vector<v4l2::Camera*> cameras;
+  /** Format of each camera, as adjusted by its driver */
+  std::vector<v4l2::Format> formats;
+  v4l2::CameraGroup* group;
+  /** One JPEG encoder and cache per camera */
+  std::vector<CompressionStage*> compression;
+  std::string defaultFormat;
+  int jpegQuality;
+  typedef IceUtil::Handle<GroupReplyTask> GroupReplyTaskPtr;
+  GroupReplyTaskPtr replyTask;
+
+  CameraGroupI(std::string propertyPrefix, Ice::CommunicatorPtr ic)
+      throw (std::string);
+  virtual ~CameraGroupI();
+  void getImageSet_async(const v4l2server::AMD_CameraGroup_getImageSetPtr& cb,
+                         const std::string& format, const Ice::Current& c);
+};
+}
+
+#endif /* JDEROBOT_COMPONENTS_GROUPI_H_ */
@@ -0,0 +1,81 @@
+/*
+ * history.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <string.h>
+#include <sstream>
+#include <string>
+
+#include "history.h"
+
+namespace v4l2 {
+
+/**
+ * Constructor
+ * @param capacity number of frames kept
+ * @param slot_size maximum size in bytes of a frame
+ */
+FrameHistory::FrameHistory(int capacity, size_t slot_size)
+    : memory_(capacity * slot_size),
+      slots_(capacity),
+      slot_size_(slot_size),
+      count_(0),
+      next_(0) {
+  for (int i = 0; i < capacity; i++) {
+    slots_[i].index = i;
+    slots_[i].mem = &memory_[i * slot_size];
+    slots_[i].size = 0;
+    slots_[i].used = 0;
+  }
+}
+
+/** Copy a frame into history, replacing the oldest one if full */
+void FrameHistory::Push(Buffer* frame) throw (std::string) {
+  if (slots_.empty()) {
+    return;
+  }
+  if (frame->size > slot_size_) {
+    std::ostringstream output_message;
+    output_message << "(FrameHistory) Frame of " << frame->size
+                   << " bytes doesn't fit in " << slot_size_ << " bytes slot";
+    throw std::string(output_message.str());
+  }
+  Buffer* slot = &slots_[next_];
+  memcpy(slot->mem, frame->mem, frame->size);
+  slot->size = frame->size;
+  slot->used = frame->size;
+  slot->sequence = frame->sequence;
+  slot->timestamp = frame->timestamp;
+  next_ = (next_ + 1) % slots_.size();
+  if (count_ < (int) slots_.size()) {
+    count_++;
+  }
+}
+
+/** Number of frames stored */
+int FrameHistory::size() {
+  return count_;
+}
+
+/** Maximum number of frames stored */
+int FrameHistory::capacity() {
+  return slots_.size();
+}
+
+/**
+ * Get a stored frame
+ * @param age 0 for last captured frame, 1 for previous one...
+ * @return stored frame or NULL if there is no frame that old
+ */
+Buffer* FrameHistory::Get(int age) {
+  if (age < 0 || age >= count_) {
+    return NULL;
+  }
+  int slot = (next_ - 1 - age + slots_.size()) % slots_.size();
+  return &slots_[slot];
+}
+
+} /* namespace */
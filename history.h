@@ -0,0 +1,45 @@
+/*
+ * history.h
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#ifndef JDEROBOT_COMPONENTS_V4L2SERVER_HISTORY_H_
+#define JDEROBOT_COMPONENTS_V4L2SERVER_HISTORY_H_
+
+#include <vector>
+
+#include "v4l2.h"
+
+namespace v4l2 {
+
+/**
+ * Last captured frames kept in memory
+ * Frames are copied into slots of a single block allocated on construction,
+ * oldest slot being overwritten by each new frame.
+ */
+class FrameHistory {
+ private:
+  /** Memory of all slots */
+  std::vector<unsigned char> memory_;
+  /** Frames stored in each slot */
+  std::vector<Buffer> slots_;
+  /** Bytes per slot */
+  size_t slot_size_;
+  /** Number of stored frames */
+  int count_;
+  /** Slot to be written by next frame */
+  int next_;
+
+ public:
+  FrameHistory(int capacity, size_t slot_size);
+  void Push(Buffer* frame) throw (std::string);
+  int size();
+  int capacity();
+  Buffer* Get(int age);
+};
+
+} /* namespace */
+
+#endif /* JDEROBOT_COMPONENTS_V4L2SERVER_HISTORY_H_ */
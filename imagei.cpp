@@ -6,16 +6,76 @@
  */
 
 #include <Ice/Ice.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <sstream>
 
 #include "imagei.h"
 
 namespace cameraserver {
 
+/** Maximum time waiting for a frame before failing pending requests (ms) */
+static const int kFrameTimeout = 2000;
+/** Frames queued for a subscriber before dropping the oldest one */
+static const int kSubscriberQueueFrames = 2;
+/** Number of served frames between metrics reports */
+static const long kMetricsReportPeriod = 100;
+
+/**
+ * Wall clock time of frame capture
+ * V4L2 timestamps come from the monotonic clock, so frame age is subtracted
+ * from current time.
+ */
+jderobot::Time captureTime(const struct timeval& timestamp) {
+  IceUtil::Time captured = IceUtil::Time::seconds(timestamp.tv_sec)
+      + IceUtil::Time::microSeconds(timestamp.tv_usec);
+  IceUtil::Time t = IceUtil::Time::now()
+      - (IceUtil::Time::now(IceUtil::Time::Monotonic) - captured);
+  jderobot::Time timeStamp;
+  timeStamp.seconds = (long) t.toSeconds();
+  timeStamp.useconds = (long) t.toMicroSeconds() - timeStamp.seconds * 1000000;
+  return timeStamp;
+}
+
+/** Statistics of a frame as sent to clients */
+static v4l2server::FrameStatistics sliceStatistics(
+    const v4l2::FrameStatistics& statistics) {
+  v4l2server::FrameStatistics output;
+  output.sequenceNumber = statistics.sequence;
+  output.timeStamp = captureTime(statistics.timestamp);
+  output.mean = statistics.mean;
+  output.variance = statistics.variance;
+  output.checksum = statistics.checksum;
+  output.histogram.assign(statistics.histogram, statistics.histogram + 256);
+  return output;
+}
+
+/** Image formats that can be requested by clients */
+bool supportedFormat(const std::string& format) {
+  return format == "RGB8" || format == "YUYV" || format == "JPEG";
+}
+
+/**
+ * Get a parameter of the request from its Ice context
+ * Clients choose image format ("format" key: RGB8, YUYV or JPEG) and JPEG
+ * quality ("quality" key) through the context of getImageData calls.
+ */
+std::string contextValue(const Ice::Current& c, const std::string& key,
+                         const std::string& defaultValue) {
+  Ice::Context::const_iterator value = c.ctx.find(key);
+  if (value == c.ctx.end()) {
+    return defaultValue;
+  }
+  return value->second;
+}
+
 CameraI::CameraI(std::string propertyPrefix, Ice::CommunicatorPtr ic)
       : prefix(propertyPrefix),
         imageConsumer(),
         rpc_mode(false),
-        format() {
+        format(new v4l2::Format()) {
 
     std::cout << "Constructor CameraI -> " << propertyPrefix << std::endl;
 
@@ -44,19 +104,69 @@ CameraI::CameraI(std::string propertyPrefix, Ice::CommunicatorPtr ic)
     // convert colorspaces to V4L2 and throw error if we don't know it
     format->format = "YUYV";
 
-    /*********************************************************************
-     imageDescription->size = imageDescription->width * imageDescription->height
-     * CV_ELEM_SIZE(imageFmt->cvType);
-     imageDescription->format = imageFmt->name;
-     ***********************************************************************/
+    imageDescription->format = fmtStr;
+    imageDescription->size = imageDescription->width * imageDescription->height
+        * (fmtStr == "YUYV" ? 2 : 3);
+    jpegQuality = prop->getPropertyAsIntWithDefault(prefix + "JpegQuality", 75);
+    historyFrames = prop->getPropertyAsIntWithDefault(prefix + "HistoryFrames",
+                                                      0);
+    maxBurstFrames = prop->getPropertyAsIntWithDefault(
+        prefix + "MaxBurstFrames", 16);
+    adaptiveBuffers = prop->getPropertyAsIntWithDefault(
+        prefix + "AdaptiveBuffers", 0);
+    minBuffers = prop->getPropertyAsIntWithDefault(prefix + "MinBuffers", 2);
+    maxBuffers = prop->getPropertyAsIntWithDefault(prefix + "MaxBuffers", 8);
+    ringQuality = prop->getPropertyAsIntWithDefault(prefix + "PreEventQuality",
+                                                     jpegQuality);
+    ringSeconds = prop->getPropertyAsIntWithDefault(prefix + "PreEventSeconds",
+                                                    30);
+    recordingDirectory = prop->getPropertyWithDefault(
+        prefix + "RecordingDirectory", ".");
+    traceFile = prop->getPropertyWithDefault(prefix + "TraceFile",
+                                             "v4l2server-trace.json");
+    if (prop->getPropertyAsIntWithDefault(prefix + "Trace", 0)) {
+      v4l2::EnableTracing(true);
+    }
 
     /* Get camera device */
     device_name = prop->getProperty(prefix + "Uri");
-    fps = prop->getPropertyAsIntWithDefault(prefix + "fps", 10);
+    fps = format->fps = prop->getPropertyAsIntWithDefault(prefix + "fps", 10);
+    /* Ring is sized in bytes; frame slots only bound its index (room for
+     * twice the configured frame rate) */
+    int ringBytes = prop->getPropertyAsIntWithDefault(prefix + "PreEventBytes",
+                                                      0);
+    ring = NULL;
+    if (ringBytes > 0) {
+      ring = new v4l2::FrameRing(ringBytes, 2 * fps * ringSeconds);
+    }
 
     std::cout << "Device name: " << device_name << std::endl;
 
-    camera = new v4l2::Camera(device_name, format, fps);
+    camera = v4l2::NewCamera(device_name, format, fps);
+    int buffers = prop->getPropertyAsIntWithDefault(prefix + "Buffers", 4);
+    if (adaptiveBuffers) {
+      buffers = std::max(minBuffers, std::min(maxBuffers, buffers));
+    }
+    camera->SetBufferCount(buffers);
+    latestFrame = prop->getPropertyAsIntWithDefault(prefix + "LatestFrame",
+                                                    0);
+    camera->SetLatestFrame(latestFrame);
+    try {
+      camera->Open();
+      camera->Initialize();
+      /* Driver may have adjusted image size and frame rate */
+      setFormat(camera->format());
+      camera->Start();
+    } catch (std::string& e) {
+      std::cout << "ERROR: " << e << std::endl;
+    }
+
+    /* SIGUSR2 dumps spans (first camera's TraceFile) */
+    try {
+      v4l2::DumpTraceOnSignal(SIGUSR2, traceFile);
+    } catch (std::string& e) {
+      std::cout << "ERROR: " << e << std::endl;
+    }
 
     replyTask = new ReplyTask(this);
     replyTask->start();  // my own thread
@@ -69,9 +179,41 @@ CameraI::CameraI(std::string propertyPrefix, Ice::CommunicatorPtr ic)
   CameraI::~CameraI() {
   }
 
+  /** Description of images in current configuration */
+  jderobot::ImageDescriptionPtr CameraI::description() {
+    IceUtil::Mutex::Lock sync(formatMutex);
+    return imageDescription;
+  }
+
+  /** Update image format after a reconfiguration */
+  void CameraI::setFormat(const v4l2::Format& newFormat) {
+    IceUtil::Mutex::Lock sync(formatMutex);
+    *format = newFormat;
+    fps = newFormat.fps;
+    jderobot::ImageDescriptionPtr newDescription =
+        new jderobot::ImageDescription();
+    newDescription->width = newFormat.width;
+    newDescription->height = newFormat.height;
+    newDescription->format = imageDescription->format;
+    newDescription->size = newFormat.width * newFormat.height
+        * (imageDescription->format == "YUYV" ? 2 : 3);
+    imageDescription = newDescription;
+  }
+
   jderobot::ImageDescriptionPtr CameraI::getImageDescription(
       const Ice::Current& c) {
-    return imageDescription;
+    jderobot::ImageDescriptionPtr current = description();
+    if (contextValue(c, "format", current->format) != "JPEG") {
+      return current;
+    }
+    /* JPEG images have no fixed size: report size of last encoded frame */
+    jderobot::ImageDescriptionPtr jpegDescription =
+        new jderobot::ImageDescription();
+    jpegDescription->width = current->width;
+    jpegDescription->height = current->height;
+    jpegDescription->format = "JPEG";
+    jpegDescription->size = compression.lastSize();
+    return jpegDescription;
   }
 
   jderobot::CameraDescriptionPtr CameraI::getCameraDescription(
@@ -82,13 +224,169 @@ CameraI::CameraI(std::string propertyPrefix, Ice::CommunicatorPtr ic)
   Ice::Int CameraI::setCameraDescription(
       const jderobot::CameraDescriptionPtr &description,
       const Ice::Current& c) {
+    /* Image size and frame rate are changed through reconfigure() */
+    cameraDescription->name = description->name;
+    cameraDescription->shortDescription = description->shortDescription;
+    cameraDescription->streamingUri = description->streamingUri;
     return 0;
   }
 
   void CameraI::getImageData_async(
       const jderobot::AMD_ImageProvider_getImageDataPtr& cb,
       const Ice::Current& c) {
-    replyTask->pushJob(cb);
+    std::string requestedFormat = contextValue(c, "format",
+                                               description()->format);
+    if (!supportedFormat(requestedFormat)) {
+      jderobot::DataNotExistException ex;
+      ex.what = "Unsupported image format " + requestedFormat;
+      cb->ice_exception(ex);
+      return;
+    }
+    replyTask->pushJob(cb, requestedFormat, requestedQuality(c));
+  }
+
+  void CameraI::getImageBurst_async(
+      const v4l2server::AMD_CaptureCamera_getImageBurstPtr& cb, Ice::Int count,
+      bool fromHistory, const std::string& burstFormat, const Ice::Current& c) {
+    std::string requestedFormat =
+        burstFormat.empty() ? description()->format : burstFormat;
+    if (!supportedFormat(requestedFormat)) {
+      jderobot::DataNotExistException ex;
+      ex.what = "Unsupported image format " + requestedFormat;
+      cb->ice_exception(ex);
+      return;
+    }
+    if (count < 1 || count > maxBurstFrames) {
+      std::ostringstream message;
+      message << "Burst size must be between 1 and " << maxBurstFrames;
+      jderobot::DataNotExistException ex;
+      ex.what = message.str();
+      cb->ice_exception(ex);
+      return;
+    }
+    replyTask->pushBurst(cb, count, fromHistory, requestedFormat,
+                         requestedQuality(c));
+  }
+
+  void CameraI::getRawFrame_async(
+      const v4l2server::AMD_CaptureCamera_getRawFramePtr& cb,
+      const Ice::Current& c) {
+    replyTask->pushRaw(cb);
+  }
+
+  void CameraI::reconfigure_async(
+      const v4l2server::AMD_CaptureCamera_reconfigurePtr& cb, Ice::Int width,
+      Ice::Int height, Ice::Int fps, const Ice::Current& c) {
+    v4l2::Format requested;
+    {
+      IceUtil::Mutex::Lock sync(formatMutex);
+      requested.format = format->format;
+    }
+    requested.width = width;
+    requested.height = height;
+    requested.fps = fps;
+    replyTask->pushReconfigure(cb, requested);
+  }
+
+  void CameraI::getFrameStatistics_async(
+      const v4l2server::AMD_CaptureCamera_getFrameStatisticsPtr& cb,
+      const Ice::Current& c) {
+    replyTask->pushStatistics(cb);
+  }
+
+  void CameraI::subscribe(const v4l2server::FrameConsumerPrx& consumer,
+                          const std::string& consumerFormat,
+                          const Ice::Current& c) {
+    std::string requestedFormat =
+        consumerFormat.empty() ? description()->format : consumerFormat;
+    if (!supportedFormat(requestedFormat)) {
+      jderobot::DataNotExistException ex;
+      ex.what = "Unsupported image format " + requestedFormat;
+      throw ex;
+    }
+    replyTask->subscribe(
+        v4l2server::FrameConsumerPrx::uncheckedCast(consumer->ice_oneway()),
+        requestedFormat, requestedQuality(c));
+  }
+
+  void CameraI::unsubscribe(const v4l2server::FrameConsumerPrx& consumer,
+                            const Ice::Current& c) {
+    replyTask->unsubscribe(consumer);
+  }
+
+  /**
+   * Dump last PreEventSeconds of the pre-event ring
+   * Files are named after camera and trigger time, and written by their own
+   * thread so capture is not stalled by the disk.
+   */
+  std::string CameraI::triggerRecording(const Ice::Current& c) {
+    unsigned long long first, last;
+    if (ring == NULL) {
+      jderobot::DataNotExistException ex;
+      ex.what = "Pre-event recording disabled";
+      throw ex;
+    }
+    long long since = v4l2::MonotonicTime() - (long long) ringSeconds * 1000000;
+    if (!ring->Window(since, &first, &last)) {
+      jderobot::DataNotExistException ex;
+      ex.what = "No frames recorded yet";
+      throw ex;
+    }
+    /* Name comes from clients too (setCameraDescription) */
+    std::string cameraName = getName().empty() ? "camera" : getName();
+    if (cameraName.find_first_of("/\\") != std::string::npos
+        || cameraName == "." || cameraName == "..") {
+      jderobot::DataNotExistException ex;
+      ex.what = "Camera name " + cameraName + " can't be used in file names";
+      throw ex;
+    }
+    time_t now = time(NULL);
+    struct tm date;
+    char name[32];
+    strftime(name, sizeof(name), "%Y%m%d-%H%M%S", localtime_r(&now, &date));
+    std::ostringstream path;
+    path << recordingDirectory << "/" << cameraName << "-" << name << "-"
+         << first;
+    IceUtil::ThreadPtr recording = new RecordingTask(ring, path.str(), first,
+                                                     last);
+    recording->start().detach();
+    return path.str() + ".mjpg";
+  }
+
+  void CameraI::setTracing(bool enabled, const Ice::Current& c) {
+    v4l2::EnableTracing(enabled);
+  }
+
+  std::string CameraI::dumpTrace(const Ice::Current& c) {
+    try {
+      int spans = v4l2::DumpTrace(traceFile);
+      std::cout << "Trace: " << spans << " spans written to " << traceFile
+                << std::endl;
+    } catch (std::string& e) {
+      jderobot::DataNotExistException ex;
+      ex.what = e;
+      throw ex;
+    }
+    return traceFile;
+  }
+
+  v4l2server::CompressionMetrics CameraI::getCompressionMetrics(
+      const Ice::Current& c) {
+    v4l2server::CompressionMetrics metrics;
+    metrics.encodedFrames = compression.encoded();
+    metrics.meanSize = compression.meanSize();
+    metrics.lastSize = compression.lastSize();
+    metrics.meanEncodeTime = compression.meanEncodeTime();
+    return metrics;
+  }
+
+  /** JPEG quality asked in request context, or default one */
+  int CameraI::requestedQuality(const Ice::Current& c) {
+    int quality = atoi(contextValue(c, "quality", "0").c_str());
+    if (quality < 1 || quality > 100) {
+      quality = jpegQuality;
+    }
+    return quality;
   }
 
   std::string CameraI::startCameraStreaming(const Ice::Current&) {
@@ -98,38 +396,784 @@ CameraI::CameraI(std::string propertyPrefix, Ice::CommunicatorPtr ic)
   void CameraI::stopCameraStreaming(const Ice::Current&) {
   }
 
+  /** Restart streaming with current configuration */
   void CameraI::reset(const Ice::Current&) {
+    v4l2::Format current;
+    {
+      IceUtil::Mutex::Lock sync(formatMutex);
+      current = *format;
+    }
+    replyTask->pushReconfigure(0, current);
+  }
+
+
+  RecordingTask::RecordingTask(v4l2::FrameRing* ring, const std::string& path,
+                               unsigned long long first,
+                               unsigned long long last)
+      : ring(ring),
+        path(path),
+        first(first),
+        last(last) {
+  }
+
+  void RecordingTask::run() {
+    IceUtil::Time start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+    try {
+      int written = ring->Dump(path, first, last);
+      IceUtil::Time elapsed = IceUtil::Time::now(IceUtil::Time::Monotonic)
+          - start;
+      std::cout << "Recording: " << written << " of " << last - first + 1
+                << " frames written to " << path << ".mjpg in "
+                << elapsed.toMilliSecondsDouble() << " ms" << std::endl;
+    } catch (std::string& e) {
+      std::cout << "ERROR: " << e << std::endl;
+    }
+  }
+
+  SubscriberTask::SubscriberTask(
+      const v4l2server::FrameConsumerPrx& consumer)
+      : consumer(consumer),
+        stopped(false),
+        failed(false),
+        dropped(0) {
+  }
+
+  /**
+   * Queue a frame, dropping the oldest queued one if consumer fell behind
+   * @return false if consumer can't be reached
+   */
+  bool SubscriberTask::push(const jderobot::ImageDataPtr& image,
+                            const v4l2server::FrameStatistics& statistics) {
+    IceUtil::Monitor<IceUtil::Mutex>::Lock sync(monitor);
+    if (failed) {
+      return false;
+    }
+    if ((int) queue.size() >= kSubscriberQueueFrames) {
+      queue.pop_front();
+      dropped++;
+    }
+    SubscriberFrame frame;
+    frame.image = image;
+    frame.statistics = statistics;
+    queue.push_back(frame);
+    monitor.notify();
+    return true;
+  }
+
+  void SubscriberTask::stop() {
+    IceUtil::Monitor<IceUtil::Mutex>::Lock sync(monitor);
+    stopped = true;
+    monitor.notify();
+  }
+
+  /** Oneway calls block when the connection is full, only this thread */
+  void SubscriberTask::run() {
+    v4l2::SetTraceThreadName("SubscriberTask");
+    while (1) {
+      SubscriberFrame frame;
+      {
+        IceUtil::Monitor<IceUtil::Mutex>::Lock sync(monitor);
+        while (queue.empty() && !stopped) {
+          monitor.wait();
+        }
+        if (stopped) {
+          break;
+        }
+        frame = queue.front();
+        queue.pop_front();
+      }
+      try {
+        consumer->report(frame.image, frame.statistics);
+      } catch (const Ice::Exception& ex) {
+        IceUtil::Monitor<IceUtil::Mutex>::Lock sync(monitor);
+        failed = true;
+        break;
+      }
+    }
+    IceUtil::Monitor<IceUtil::Mutex>::Lock sync(monitor);
+    std::cout << "Frame consumer " << (failed ? "failed" : "unsubscribed")
+              << ", " << dropped << " frames dropped" << std::endl;
+  }
+
+  RingTask::RingTask(v4l2::FrameRing* ring, int quality)
+      : ring(ring),
+        quality(quality),
+        busy(false),
+        skipped(0) {
+  }
+
+  /** Copy frame for the encoder, unless it's still busy with previous one */
+  void RingTask::push(v4l2::Buffer* frame, const v4l2::Format& format) {
+    IceUtil::Monitor<IceUtil::Mutex>::Lock sync(monitor);
+    if (busy) {
+      if (++skipped % kMetricsReportPeriod == 1) {
+        std::cout << "Pre-event ring: " << skipped
+                  << " frames skipped, encoder busy" << std::endl;
+      }
+      return;
+    }
+    staging.assign((unsigned char*) frame->mem,
+                   (unsigned char*) frame->mem + frame->size);
+    this->frame = *frame;
+    this->frame.mem = &staging[0];
+    this->format = format;
+    busy = true;
+    monitor.notify();
   }
 
+  void RingTask::run() {
+    v4l2::SetTraceThreadName("RingTask");
+    std::vector<unsigned char> jpeg;
+    while (1) {
+      {
+        IceUtil::Monitor<IceUtil::Mutex>::Lock sync(monitor);
+        while (!busy) {
+          monitor.wait();
+        }
+      }
+      /* Staging memory is left alone by push() while busy */
+      try {
+        v4l2::ScopedSpan span("ring encode", frame.sequence);
+        encoder.Encode(&frame, &format, quality, &jpeg);
+        ring->Push(&jpeg[0], jpeg.size(), frame.sequence, frame.timestamp);
+      } catch (std::string& e) {
+        std::cout << "ERROR: " << e << std::endl;
+      }
+      IceUtil::Monitor<IceUtil::Mutex>::Lock sync(monitor);
+      busy = false;
+    }
+  }
 
-  ReplyTask::ReplyTask(CameraI* camera) {
+  ReplyTask::ReplyTask(CameraI* camera)
+      : statisticsWanted(false),
+        firstFramePending(false),
+        history(NULL),
+        bufferController(NULL),
+        convertedSequence(0),
+        servedFrames(0),
+        servedReplies(0),
+        copiedBytes(0),
+        latencyReplies(0),
+        latencySum(0),
+        latencyMax(0),
+        reportedSkips(0) {
       std::cout << "safeThread" << std::endl;
       mycamera = camera;
+      if (camera->historyFrames > 0) {
+        history = new v4l2::FrameHistory(
+            camera->historyFrames,
+            camera->format->width * camera->format->height * 2);
+      }
+      if (camera->ring != NULL) {
+        ringTask = new RingTask(camera->ring, camera->ringQuality);
+        ringTask->start().detach();
+      }
+      if (camera->adaptiveBuffers) {
+        bufferController = new v4l2::BufferController(camera->minBuffers,
+                                                       camera->maxBuffers,
+                                                       camera->fps);
+      }
+    }
+
+    void ReplyTask::pushJob(
+        const jderobot::AMD_ImageProvider_getImageDataPtr& cb,
+        const std::string& format, int quality) {
+      IceUtil::Monitor<IceUtil::Mutex>::Lock sync(requestsMonitor);
+      ImageRequest request;
+      request.cb = cb;
+      request.format = format;
+      request.quality = quality;
+      request.queued = v4l2::TracingEnabled() ? v4l2::MonotonicTime() : 0;
+      requests.push_back(request);
+      requestsMonitor.notify();
+    }
+
+    void ReplyTask::pushBurst(
+        const v4l2server::AMD_CaptureCamera_getImageBurstPtr& cb, int count,
+        bool fromHistory, const std::string& format, int quality) {
+      IceUtil::Monitor<IceUtil::Mutex>::Lock sync(requestsMonitor);
+      BurstRequest burst;
+      burst.cb = cb;
+      burst.count = count;
+      burst.fromHistory = fromHistory;
+      burst.format = format;
+      burst.quality = quality;
+      burst.queued = v4l2::TracingEnabled() ? v4l2::MonotonicTime() : 0;
+      bursts.push_back(burst);
+      requestsMonitor.notify();
     }
 
-    void ReplyTask::pushJob(const jderobot::AMD_ImageProvider_getImageDataPtr& cb) {
-      IceUtil::Mutex::Lock sync(requestsMutex);
-      requests.push_back(cb);
+    void ReplyTask::pushRaw(
+        const v4l2server::AMD_CaptureCamera_getRawFramePtr& cb) {
+      IceUtil::Monitor<IceUtil::Mutex>::Lock sync(requestsMonitor);
+      RawRequest request;
+      request.cb = cb;
+      request.queued = v4l2::TracingEnabled() ? v4l2::MonotonicTime() : 0;
+      rawRequests.push_back(request);
+      requestsMonitor.notify();
+    }
+
+    void ReplyTask::pushReconfigure(
+        const v4l2server::AMD_CaptureCamera_reconfigurePtr& cb,
+        const v4l2::Format& format) {
+      IceUtil::Monitor<IceUtil::Mutex>::Lock sync(requestsMonitor);
+      ReconfigureRequest request;
+      request.cb = cb;
+      request.format = format;
+      reconfigurations.push_back(request);
+      requestsMonitor.notify();
+    }
+
+    /**
+     * Apply a new image size and frame rate
+     * Called between frames, so no V4L2 buffer is held by the server; the
+     * device stays opened and the stream is restarted with the new format.
+     */
+    void ReplyTask::reconfigure(ReconfigureRequest& request) {
+      v4l2::Format requested = request.format;
+      std::ostringstream message;
+      message << requested.format << " " << requested.width << "x"
+              << requested.height << " @" << requested.fps << "fps";
+      try {
+        if (!mycamera->camera->IsSupported(&requested)) {
+          jderobot::DataNotExistException ex;
+          ex.what = mycamera->device_name + " doesn't support "
+              + message.str();
+          std::cout << "ERROR: " << ex.what << std::endl;
+          if (request.cb) {
+            request.cb->ice_exception(ex);
+          }
+          return;
+        }
+        restartTime = IceUtil::Time::now(IceUtil::Time::Monotonic);
+        mycamera->camera->Reconfigure(&requested);
+      } catch (std::string& e) {
+        jderobot::HardwareFailedException ex;
+        ex.what = e;
+        std::cout << "ERROR: " << e << std::endl;
+        if (request.cb) {
+          request.cb->ice_exception(ex);
+        }
+        return;
+      }
+      IceUtil::Time elapsed = IceUtil::Time::now(IceUtil::Time::Monotonic)
+          - restartTime;
+      std::cout << "Reconfigured to " << message.str() << " with "
+                << mycamera->camera->num_buffers() << " buffers in "
+                << elapsed.toMilliSecondsDouble() << " ms" << std::endl;
+
+      /* Sequence numbers go on across restarts, so cached images and
+       * history are kept unless image size changed (as when only the
+       * number of buffers changes) */
+      bool resized = requested.width != mycamera->format->width
+          || requested.height != mycamera->format->height;
+      mycamera->setFormat(requested);
+      if (resized) {
+        mycamera->compression.invalidate();
+        converted.clear();
+        if (history != NULL) {
+          int capacity = history->capacity();
+          delete history;
+          history = new v4l2::FrameHistory(
+              capacity, requested.width * requested.height * 2);
+        }
+      }
+      if (bufferController != NULL) {
+        bufferController->Reset(requested.fps);
+      }
+      firstFramePending = true;
+      if (request.cb) {
+        request.cb->ice_response(mycamera->description());
+      }
+    }
+
+    /**
+     * Build a reply with frame data in a uncompressed format
+     * Reply objects are pooled: last frame reply is reused unless it was
+     * kept, so RGB8 conversion writes straight into the memory Ice will
+     * marshal and YUYV costs a single copy from the mmap'd V4L2 buffer,
+     * shared by every client of the frame. ice_response marshals before
+     * returning, so only replies kept beyond their frame need their own
+     * buffer.
+     */
+    jderobot::ImageDataPtr ReplyTask::convert(
+        v4l2::Buffer* frame, const std::string& format,
+        v4l2::FrameStatistics* frameStatistics) {
+      jderobot::ImageDataPtr& reply = pool[format];
+      if (!reply) {
+        reply = new jderobot::ImageData;
+        reply->description = new jderobot::ImageDescription();
+        reply->description->format = format;
+      }
+      reply->description->width = mycamera->format->width;
+      reply->description->height = mycamera->format->height;
+      if (format == "YUYV") {
+        unsigned char* data = (unsigned char*) frame->mem;
+        reply->pixelData.assign(data, data + frame->size);
+        copiedBytes += frame->size;
+      } else {
+        reply->pixelData.resize(
+            mycamera->format->width * mycamera->format->height * 3);
+        mycamera->camera->YuyvToRgb24(frame, &reply->pixelData[0],
+                                      reply->pixelData.size(),
+                                      frameStatistics);
+      }
+      reply->description->size = reply->pixelData.size();
+      return reply;
+    }
+
+    /**
+     * Get frame in requested format, converting it only once per frame
+     * @param frameStatistics if not NULL, filled by the conversion pass
+     * @return image stamped with frame capture time
+     */
+    jderobot::ImageDataPtr ReplyTask::encode(
+        v4l2::Buffer* frame, const std::string& format, int quality,
+        v4l2::FrameStatistics* frameStatistics) throw (std::string) {
+      v4l2::ScopedSpan span("convert", frame->sequence);
+      if (frame->sequence != convertedSequence) {
+        converted.clear();
+        convertedSequence = frame->sequence;
+      }
+      jderobot::ImageDataPtr reply;
+      if (format == "JPEG") {
+        reply = mycamera->compression.compress(frame, mycamera->format,
+                                               quality, frameStatistics);
+      } else {
+        reply = converted[format];
+        if (!reply) {
+          reply = converted[format] = convert(frame, format, frameStatistics);
+        }
+      }
+      reply->timeStamp = captureTime(frame->timestamp);
+      return reply;
+    }
+
+    /** Take a reply out of the pool, as it's kept after its frame */
+    void ReplyTask::keep(const jderobot::ImageDataPtr& reply) {
+      std::map<std::string, jderobot::ImageDataPtr>::iterator pooled =
+          pool.find(reply->description->format);
+      if (pooled != pool.end() && pooled->second == reply) {
+        pool.erase(pooled);
+      }
+    }
+
+    /** Answer a burst request with the last frames kept in history */
+    void ReplyTask::replyFromHistory(BurstRequest& burst) {
+      if (history == NULL) {
+        jderobot::DataNotExistException ex;
+        ex.what = "Frame history disabled";
+        burst.cb->ice_exception(ex);
+        return;
+      }
+      if (history->size() < burst.count) {
+        std::ostringstream message;
+        message << "Only " << history->size() << " frames in history";
+        jderobot::DataNotExistException ex;
+        ex.what = message.str();
+        burst.cb->ice_exception(ex);
+        return;
+      }
+      /* Oldest frame first, as in bursts of next frames */
+      try {
+        for (int age = burst.count - 1; age >= 0; age--) {
+          v4l2::Buffer* frame = history->Get(age);
+          v4l2server::Frame burstFrame;
+          burstFrame.sequenceNumber = frame->sequence;
+          burstFrame.image = encode(frame, burst.format, burst.quality, NULL);
+          keep(burstFrame.image);
+          burst.frames.push_back(burstFrame);
+        }
+      } catch (std::string& e) {
+        jderobot::HardwareFailedException ex;
+        ex.what = e;
+        burst.cb->ice_exception(ex);
+        return;
+      }
+      burst.cb->ice_response(burst.frames);
+    }
+
+    /** Account frame age once a reply with it has been sent */
+    void ReplyTask::recordLatency(v4l2::Buffer* frame) {
+      long long latency = v4l2::FrameAge(frame);
+      latencyReplies++;
+      latencySum += latency;
+      latencyMax = std::max(latencyMax, latency);
+    }
+
+    /** Statistics to be filled by next conversion of current frame */
+    v4l2::FrameStatistics* ReplyTask::fusedStatistics() {
+      return statisticsWanted && !statistics.valid ? &statistics : NULL;
+    }
+
+    /**
+     * Answer statistics requests and queue frame for subscribers
+     * Subscriber images are converted first, so statistics come from their
+     * conversion pass when possible; otherwise they get a pass of their own.
+     */
+    void ReplyTask::publish(
+        v4l2::Buffer* frame,
+        std::list<v4l2server::AMD_CaptureCamera_getFrameStatisticsPtr>&
+            statisticsRequests,
+        std::list<Subscriber>& consumers) {
+      std::vector<jderobot::ImageDataPtr> images;
+      std::list<Subscriber>::iterator consumer;
+      for (consumer = consumers.begin(); consumer != consumers.end();
+          ++consumer) {
+        try {
+          images.push_back(encode(frame, consumer->format, consumer->quality,
+                                  fusedStatistics()));
+        } catch (std::string& e) {
+          std::cout << "ERROR: " << e << std::endl;
+          images.push_back(0);
+        }
+      }
+      if (!statistics.valid) {
+        v4l2::ComputeStatistics(frame, &statistics);
+      }
+      v4l2server::FrameStatistics frameStatistics = sliceStatistics(statistics);
+      while (!statisticsRequests.empty()) {
+        statisticsRequests.front()->ice_response(frameStatistics);
+        statisticsRequests.pop_front();
+      }
+      std::vector<jderobot::ImageDataPtr>::iterator image = images.begin();
+      for (consumer = consumers.begin(); consumer != consumers.end();
+          ++consumer, ++image) {
+        if (!*image) {
+          continue;
+        }
+        keep(*image);
+        if (!consumer->task->push(*image, frameStatistics)) {
+          std::cout << "ERROR: Frame consumer unreachable, unsubscribed"
+                    << std::endl;
+          unsubscribe(consumer->consumer);
+        }
+      }
+    }
+
+    void ReplyTask::pushStatistics(
+        const v4l2server::AMD_CaptureCamera_getFrameStatisticsPtr& cb) {
+      IceUtil::Monitor<IceUtil::Mutex>::Lock sync(requestsMonitor);
+      statisticsRequests.push_back(cb);
+      requestsMonitor.notify();
+    }
+
+    void ReplyTask::subscribe(const v4l2server::FrameConsumerPrx& consumer,
+                              const std::string& format, int quality) {
+      IceUtil::Monitor<IceUtil::Mutex>::Lock sync(requestsMonitor);
+      Subscriber subscriber;
+      subscriber.consumer = consumer;
+      subscriber.format = format;
+      subscriber.quality = quality;
+      subscriber.task = new SubscriberTask(consumer);
+      subscriber.task->start().detach();
+      subscribers.push_back(subscriber);
+      requestsMonitor.notify();
+    }
+
+    void ReplyTask::unsubscribe(const v4l2server::FrameConsumerPrx& consumer) {
+      IceUtil::Monitor<IceUtil::Mutex>::Lock sync(requestsMonitor);
+      std::list<Subscriber>::iterator subscriber = subscribers.begin();
+      while (subscriber != subscribers.end()) {
+        if (subscriber->consumer->ice_getIdentity()
+            == consumer->ice_getIdentity()) {
+          subscriber->task->stop();
+          subscriber = subscribers.erase(subscriber);
+        } else {
+          ++subscriber;
+        }
+      }
     }
 
     void ReplyTask::run() {
-      jderobot::ImageDataPtr reply(new jderobot::ImageData);
-      ::jderobot::Time t;
+      v4l2::SetTraceThreadName("ReplyTask " + mycamera->device_name);
+      /* Bursts waiting for next frames */
+      std::list<BurstRequest> activeBursts;
       while (1) {
-        IceUtil::Time t = IceUtil::Time::now();
-        reply->timeStamp.seconds = (long) t.toSeconds();
-        reply->timeStamp.useconds = (long) t.toMicroSeconds()
-            - reply->timeStamp.seconds * 1000000;
+        std::list<ImageRequest> pending;
+        std::list<BurstRequest> newBursts;
+        std::list<RawRequest> pendingRaw;
+        std::list<ReconfigureRequest> newReconfigurations;
+        std::list<v4l2server::AMD_CaptureCamera_getFrameStatisticsPtr>
+            pendingStatistics;
+        std::list<Subscriber> consumers;
         {  //critical region start
-          IceUtil::Mutex::Lock sync(requestsMutex);
-          while (!requests.empty()) {
-            jderobot::AMD_ImageProvider_getImageDataPtr cb = requests.front();
-            requests.pop_front();
-            cb->ice_response(reply);
+          IceUtil::Monitor<IceUtil::Mutex>::Lock sync(requestsMonitor);
+          /* Sleep until a client asks for an image (history, pre-event ring
+           * and subscribers need every frame, so there is no sleep when they
+           * are enabled) */
+          while (requests.empty() && bursts.empty() && activeBursts.empty()
+              && rawRequests.empty()
+              && reconfigurations.empty() && statisticsRequests.empty()
+              && subscribers.empty() && !firstFramePending
+              && history == NULL && mycamera->ring == NULL) {
+            requestsMonitor.wait();
+          }
+          pending.swap(requests);
+          newBursts.swap(bursts);
+          pendingRaw.swap(rawRequests);
+          newReconfigurations.swap(reconfigurations);
+          pendingStatistics.swap(statisticsRequests);
+          consumers = subscribers;
+        }
+        /* Reconfigure before serving, so pending requests get new format */
+        if (!newReconfigurations.empty()) {
+          while (!activeBursts.empty()) {
+            jderobot::DataNotExistException ex;
+            ex.what = "Camera reconfigured during burst";
+            activeBursts.front().cb->ice_exception(ex);
+            activeBursts.pop_front();
+          }
+        }
+        while (!newReconfigurations.empty()) {
+          reconfigure(newReconfigurations.front());
+          newReconfigurations.pop_front();
+        }
+        while (!newBursts.empty()) {
+          if (newBursts.front().fromHistory) {
+            replyFromHistory(newBursts.front());
+          } else {
+            activeBursts.push_back(newBursts.front());
+          }
+          newBursts.pop_front();
+        }
+        if (pending.empty() && activeBursts.empty() && pendingRaw.empty()
+            && !firstFramePending
+            && pendingStatistics.empty() && consumers.empty()
+            && history == NULL && mycamera->ring == NULL) {
+          continue;
+        }
+
+        v4l2::Buffer* frame = NULL;
+        long skipped = mycamera->camera->skipped_frames();
+        std::string error;
+        try {
+          if (!mycamera->camera->is_active()) {
+            error = "Camera " + mycamera->device_name + " not active";
+          } else {
+            /* Bursts need frames in queue order */
+            mycamera->camera->SetLatestFrame(
+                mycamera->latestFrame && activeBursts.empty());
+            frame = mycamera->camera->WaitFrame(kFrameTimeout);
+          }
+        } catch (std::string& e) {
+          error = e;
+        }
+        if (frame == NULL) {
+          firstFramePending = false;
+          if (!error.empty()) {
+            if (error != lastError) {
+              std::cout << "ERROR: " << error << std::endl;
+              lastError = error;
+            }
+            /* Camera fails right away: don't spin while history, ring or
+             * subscribers keep capture going, wake up for new requests */
+            IceUtil::Monitor<IceUtil::Mutex>::Lock sync(requestsMonitor);
+            if (requests.empty() && bursts.empty() && rawRequests.empty()
+                && reconfigurations.empty() && statisticsRequests.empty()) {
+              requestsMonitor.timedWait(
+                  IceUtil::Time::milliSeconds(kFrameTimeout));
+            }
+          }
+          if (pending.empty() && activeBursts.empty() && pendingRaw.empty()
+              && pendingStatistics.empty()) {
+            continue;
+          }
+          jderobot::HardwareFailedException ex;
+          ex.what = error.empty() ? "Timeout waiting for frame" : error;
+          if (error.empty()) {
+            std::cout << "ERROR: " << ex.what << std::endl;
+          }
+          while (!pending.empty()) {
+            pending.front().cb->ice_exception(ex);
+            pending.pop_front();
           }
+          while (!activeBursts.empty()) {
+            activeBursts.front().cb->ice_exception(ex);
+            activeBursts.pop_front();
+          }
+          while (!pendingRaw.empty()) {
+            pendingRaw.front().cb->ice_exception(ex);
+            pendingRaw.pop_front();
+          }
+          while (!pendingStatistics.empty()) {
+            pendingStatistics.front()->ice_exception(ex);
+            pendingStatistics.pop_front();
+          }
+          continue;
+        }
+        lastError.clear();
+        if (bufferController != NULL) {
+          bufferController->OnDequeue(
+              frame, mycamera->camera->skipped_frames() - skipped);
+        }
+        if (firstFramePending) {
+          IceUtil::Time elapsed = IceUtil::Time::now(IceUtil::Time::Monotonic)
+              - restartTime;
+          std::cout << "First frame " << elapsed.toMilliSecondsDouble()
+                    << " ms after reconfiguration" << std::endl;
+          firstFramePending = false;
+        }
+        statisticsWanted = !pendingStatistics.empty() || !consumers.empty();
+        statistics.valid = false;
+        if (history != NULL) {
+          try {
+            history->Push(frame);
+          } catch (std::string& e) {
+            std::cout << "ERROR: " << e << std::endl;
+          }
+        }
+
+        while (!pending.empty()) {
+          ImageRequest& request = pending.front();
+          if (request.queued != 0) {
+            v4l2::RecordSpan("queued", request.queued, v4l2::MonotonicTime(),
+                             frame->sequence);
+          }
+          jderobot::ImageDataPtr reply;
+          try {
+            reply = encode(frame, request.format, request.quality,
+                           fusedStatistics());
+          } catch (std::string& e) {
+            jderobot::HardwareFailedException ex;
+            ex.what = e;
+            request.cb->ice_exception(ex);
+            pending.pop_front();
+            continue;
+          }
+          /* Reply is marshaled before ice_response returns */
+          {
+            v4l2::ScopedSpan span("ice_response", frame->sequence);
+            request.cb->ice_response(reply);
+          }
+          recordLatency(frame);
+          servedReplies++;
+          pending.pop_front();
+        }
+        /* Marshaled from the mmap'd buffer, which is still ours */
+        if (!pendingRaw.empty()) {
+          v4l2server::FrameInfo info;
+          info.sequenceNumber = frame->sequence;
+          info.timeStamp = captureTime(frame->timestamp);
+          info.width = mycamera->format->width;
+          info.height = mycamera->format->height;
+          info.format = mycamera->format->format;
+          const Ice::Byte* data = (const Ice::Byte*) frame->mem;
+          std::pair<const Ice::Byte*, const Ice::Byte*> raw(data,
+                                                          data + frame->size);
+          while (!pendingRaw.empty()) {
+            RawRequest& request = pendingRaw.front();
+            if (request.queued != 0) {
+              v4l2::RecordSpan("queued", request.queued,
+                               v4l2::MonotonicTime(), frame->sequence);
+            }
+            {
+              v4l2::ScopedSpan span("ice_response", frame->sequence);
+              request.cb->ice_response(info, raw);
+            }
+            recordLatency(frame);
+            servedReplies++;
+            pendingRaw.pop_front();
+          }
+        }
+        std::list<BurstRequest>::iterator burst = activeBursts.begin();
+        while (burst != activeBursts.end()) {
+          v4l2server::Frame burstFrame;
+          burstFrame.sequenceNumber = frame->sequence;
+          if (burst->frames.empty() && burst->queued != 0) {
+            v4l2::RecordSpan("queued", burst->queued, v4l2::MonotonicTime(),
+                             frame->sequence);
+          }
+          /* Frames lost by the driver break the burst */
+          if (!burst->frames.empty()
+              && burstFrame.sequenceNumber
+                  != burst->frames.back().sequenceNumber + 1) {
+            jderobot::DataNotExistException ex;
+            std::ostringstream message;
+            message << "Frame " << burst->frames.back().sequenceNumber + 1
+                    << " lost during burst";
+            ex.what = message.str();
+            burst->cb->ice_exception(ex);
+            burst = activeBursts.erase(burst);
+            continue;
+          }
+          try {
+            burstFrame.image = encode(frame, burst->format, burst->quality,
+                                      fusedStatistics());
+          } catch (std::string& e) {
+            jderobot::HardwareFailedException ex;
+            ex.what = e;
+            burst->cb->ice_exception(ex);
+            burst = activeBursts.erase(burst);
+            continue;
+          }
+          burst->frames.push_back(burstFrame);
+          if ((int) burst->frames.size() < burst->count) {
+            keep(burstFrame.image);
+            ++burst;
+            continue;
+          }
+          /* Whole burst marshaled in a single reply */
+          {
+            v4l2::ScopedSpan span("ice_response", frame->sequence);
+            burst->cb->ice_response(burst->frames);
+          }
+          recordLatency(frame);
+          servedReplies++;
+          burst = activeBursts.erase(burst);
+        }
+        /* Ring shares the encode of clients asking for the same quality,
+         * otherwise frame is encoded off this thread */
+        if (mycamera->ring != NULL) {
+          jderobot::ImageDataPtr jpeg = mycamera->compression.cached(
+              frame, mycamera->ringQuality);
+          if (jpeg) {
+            mycamera->ring->Push(&jpeg->pixelData[0], jpeg->pixelData.size(),
+                                 frame->sequence, frame->timestamp);
+          } else {
+            ringTask->push(frame, *mycamera->format);
+          }
+        }
+        if (statisticsWanted) {
+          publish(frame, pendingStatistics, consumers);
+        }
+        /* Frame lease ends once every reply using it has been marshaled */
+        try {
+          mycamera->camera->FreeFrame(frame);
+        } catch (std::string& e) {
+          std::cout << "ERROR: " << e << std::endl;
+        }
+        /* Buffers are resized by a warm restart, not in the middle of a
+         * burst */
+        if (bufferController != NULL) {
+          bufferController->OnRelease();
+          int buffers = mycamera->camera->num_buffers();
+          int wanted = activeBursts.empty() ?
+              bufferController->Decide(buffers) : buffers;
+          if (wanted != buffers) {
+            mycamera->camera->SetBufferCount(wanted);
+            pushReconfigure(0, *mycamera->format);
+          }
+        }
+        if (++servedFrames % kMetricsReportPeriod == 0 && servedReplies > 0) {
+          std::cout << "Replies: " << servedFrames << " frames, "
+                    << (double) servedReplies / servedFrames
+                    << " replies/frame, " << copiedBytes / servedFrames
+                    << " bytes copied/frame, " << copiedBytes / servedReplies
+                    << " bytes copied/reply" << std::endl;
+        }
+        if (servedFrames % kMetricsReportPeriod == 0 && latencyReplies > 0) {
+          long skipped = mycamera->camera->skipped_frames();
+          std::cout << "Latency: " << latencySum / latencyReplies / 1000.0
+                    << " ms mean, " << latencyMax / 1000.0
+                    << " ms max glass-to-client, " << skipped - reportedSkips
+                    << " stale frames skipped" << std::endl;
+          latencyReplies = 0;
+          latencySum = 0;
+          latencyMax = 0;
+          reportedSkips = skipped;
         }
       }
     }
 
 }  //namespace
-
@@ -10,11 +10,21 @@
 
 #include <IceUtil/IceUtil.h>
 #include <list>
+#include <map>
 
 #include <jderobot/camera.h>
 #include <jderobot/image.h>
 #include <jderobot/datetime.h>
 
+#include "buffers.h"
+#include "capture.h"
+#include "compression.h"
+#include "history.h"
+#include "jpeg.h"
+#include "ring.h"
+#include "statistics.h"
+#include "synthetic.h"
+#include "trace.h"
 #include "v4l2.h"
 
 namespace cameraserver {
@@ -22,19 +32,198 @@ namespace cameraserver {
 class ReplyTask;
 class CameraI;
 
+jderobot::Time captureTime(const struct timeval& timestamp);
+bool supportedFormat(const std::string& format);
+std::string contextValue(const Ice::Current& c, const std::string& key,
+                         const std::string& defaultValue);
+
+/** Pending getImageData call and the image format requested by client */
+struct ImageRequest {
+  jderobot::AMD_ImageProvider_getImageDataPtr cb;
+  std::string format;
+  int quality;
+  /** Monotonic time when queued (0 if tracing disabled) */
+  long long queued;
+};
+
+/** Pending getImageBurst call and the frames already collected for it */
+struct BurstRequest {
+  v4l2server::AMD_CaptureCamera_getImageBurstPtr cb;
+  int count;
+  bool fromHistory;
+  std::string format;
+  int quality;
+  long long queued;
+  v4l2server::FrameSeq frames;
+};
+
+/** Pending getRawFrame call */
+struct RawRequest {
+  v4l2server::AMD_CaptureCamera_getRawFramePtr cb;
+  long long queued;
+};
+
+/** Frame waiting to be pushed to a subscriber */
+struct SubscriberFrame {
+  jderobot::ImageDataPtr image;
+  v4l2server::FrameStatistics statistics;
+};
+
+/**
+ * Pushes frames to a subscriber from its own thread
+ * A consumer slower than the camera gets only the newest frames: capture
+ * never waits for it.
+ */
+class SubscriberTask : public IceUtil::Thread {
+ private:
+  v4l2server::FrameConsumerPrx consumer;
+  IceUtil::Monitor<IceUtil::Mutex> monitor;
+  std::list<SubscriberFrame> queue;
+  bool stopped;
+  /** Consumer unreachable, to be unsubscribed */
+  bool failed;
+  long dropped;
+
+ public:
+  SubscriberTask(const v4l2server::FrameConsumerPrx& consumer);
+  bool push(const jderobot::ImageDataPtr& image,
+            const v4l2server::FrameStatistics& statistics);
+  void stop();
+  virtual void run();
+};
+
+/** Client receiving every frame */
+struct Subscriber {
+  v4l2server::FrameConsumerPrx consumer;
+  std::string format;
+  int quality;
+  IceUtil::Handle<SubscriberTask> task;
+};
+
+/** Pending change of image size and frame rate (no callback on reset) */
+struct ReconfigureRequest {
+  v4l2server::AMD_CaptureCamera_reconfigurePtr cb;
+  v4l2::Format format;
+};
+
+/** Writes a window of the pre-event ring to disk */
+class RecordingTask : public IceUtil::Thread {
+ private:
+  v4l2::FrameRing* ring;
+  std::string path;
+  unsigned long long first;
+  unsigned long long last;
+
+ public:
+  RecordingTask(v4l2::FrameRing* ring, const std::string& path,
+                unsigned long long first, unsigned long long last);
+  virtual void run();
+};
+
+/**
+ * Encodes frames for the pre-event ring from its own thread
+ * Frames are copied, so capture buffers are requeued without waiting for
+ * the encoder. Frames arriving while it's busy are left out of the ring.
+ */
+class RingTask : public IceUtil::Thread {
+ private:
+  v4l2::FrameRing* ring;
+  int quality;
+  v4l2::JpegEncoder encoder;
+  IceUtil::Monitor<IceUtil::Mutex> monitor;
+  /** Copy of frame being encoded, and its format */
+  std::vector<unsigned char> staging;
+  v4l2::Buffer frame;
+  v4l2::Format format;
+  bool busy;
+  long skipped;
+
+ public:
+  RingTask(v4l2::FrameRing* ring, int quality);
+  void push(v4l2::Buffer* frame, const v4l2::Format& format);
+  virtual void run();
+};
+
 class ReplyTask : public IceUtil::Thread {
  private:
   CameraI* mycamera;
-  IceUtil::Mutex requestsMutex;
-  std::list<jderobot::AMD_ImageProvider_getImageDataPtr> requests;
+  IceUtil::Monitor<IceUtil::Mutex> requestsMonitor;
+  std::list<ImageRequest> requests;
+  std::list<BurstRequest> bursts;
+  std::list<RawRequest> rawRequests;
+  std::list<ReconfigureRequest> reconfigurations;
+  std::list<v4l2server::AMD_CaptureCamera_getFrameStatisticsPtr>
+      statisticsRequests;
+  std::list<Subscriber> subscribers;
+  /** Statistics of frame being served, if someone wants them */
+  bool statisticsWanted;
+  v4l2::FrameStatistics statistics;
+  /** Stream restarted and its first frame not dequeued yet */
+  bool firstFramePending;
+  /** Start time of last reconfiguration */
+  IceUtil::Time restartTime;
+  /** Last capture error logged (empty once frames arrive again) */
+  std::string lastError;
+  /** Last captured frames (NULL if disabled) */
+  v4l2::FrameHistory* history;
+  /** Encoder of frames not encoded for clients (NULL if ring disabled) */
+  IceUtil::Handle<RingTask> ringTask;
+  /** Chooses number of capture buffers (NULL if fixed) */
+  v4l2::BufferController* bufferController;
+  /** Uncompressed replies reused between frames, indexed by format
+   * (replies kept after their frame is released are taken out of it) */
+  std::map<std::string, jderobot::ImageDataPtr> pool;
+  /** Replies of frame being served, indexed by format */
+  std::map<std::string, jderobot::ImageDataPtr> converted;
+  unsigned int convertedSequence;
+  /** Copy metrics */
+  long servedFrames;
+  long servedReplies;
+  long copiedBytes;
+  /** Glass-to-client latency (frame age once reply is sent) since last
+   * report */
+  long latencyReplies;
+  long long latencySum;
+  long long latencyMax;
+  long reportedSkips;
+
+  jderobot::ImageDataPtr convert(v4l2::Buffer* frame,
+                                 const std::string& format,
+                                 v4l2::FrameStatistics* frameStatistics);
+  jderobot::ImageDataPtr encode(v4l2::Buffer* frame,
+                                const std::string& format, int quality,
+                                v4l2::FrameStatistics* frameStatistics)
+                                    throw (std::string);
+  v4l2::FrameStatistics* fusedStatistics();
+  void publish(
+      v4l2::Buffer* frame,
+      std::list<v4l2server::AMD_CaptureCamera_getFrameStatisticsPtr>&
+          statisticsRequests,
+      std::list<Subscriber>& consumers);
+  void keep(const jderobot::ImageDataPtr& reply);
+  void replyFromHistory(BurstRequest& burst);
+  void reconfigure(ReconfigureRequest& request);
+  void recordLatency(v4l2::Buffer* frame);
 
  public:
   ReplyTask(CameraI* camera);
-  void pushJob(const jderobot::AMD_ImageProvider_getImageDataPtr& cb);
+  void pushJob(const jderobot::AMD_ImageProvider_getImageDataPtr& cb,
+               const std::string& format, int quality);
+  void pushBurst(const v4l2server::AMD_CaptureCamera_getImageBurstPtr& cb,
+                 int count, bool fromHistory, const std::string& format,
+                 int quality);
+  void pushRaw(const v4l2server::AMD_CaptureCamera_getRawFramePtr& cb);
+  void pushReconfigure(const v4l2server::AMD_CaptureCamera_reconfigurePtr& cb,
+                       const v4l2::Format& format);
+  void pushStatistics(
+      const v4l2server::AMD_CaptureCamera_getFrameStatisticsPtr& cb);
+  void subscribe(const v4l2server::FrameConsumerPrx& consumer,
+                 const std::string& format, int quality);
+  void unsubscribe(const v4l2server::FrameConsumerPrx& consumer);
   virtual void run();
 };
 
-class CameraI : virtual public jderobot::Camera {
+class CameraI : virtual public v4l2server::CaptureCamera {
 
  public:
 
@@ -51,6 +240,27 @@ class CameraI : virtual public jderobot::Camera {
   bool rpc_mode;
   jderobot::ImageConsumerPrx imageConsumer;
   int mirror;
+  /** Default JPEG quality for clients not setting it in request context */
+  int jpegQuality;
+  CompressionStage compression;
+  /** Number of frames kept in memory for bursts (0 disables history) */
+  int historyFrames;
+  int maxBurstFrames;
+  /** Bounds of number of capture buffers when it's adaptive */
+  bool adaptiveBuffers;
+  int minBuffers;
+  int maxBuffers;
+  /** Serve newest frame only (off while bursts collect consecutive ones) */
+  bool latestFrame;
+  /** Last compressed frames kept for recordings (NULL if disabled) */
+  v4l2::FrameRing* ring;
+  int ringQuality;
+  int ringSeconds;
+  std::string recordingDirectory;
+  /** Destination of dumped span traces */
+  std::string traceFile;
+  /** Protects format and imageDescription, changed on reconfiguration */
+  IceUtil::Mutex formatMutex;
 
   CameraI(std::string propertyPrefix, Ice::CommunicatorPtr ic);
   std::string getName();
@@ -63,6 +273,30 @@ class CameraI : virtual public jderobot::Camera {
       const jderobot::CameraDescriptionPtr &description, const Ice::Current& c);
   void getImageData_async(const jderobot::AMD_ImageProvider_getImageDataPtr& cb,
                           const Ice::Current& c);
+  void getImageBurst_async(
+      const v4l2server::AMD_CaptureCamera_getImageBurstPtr& cb, Ice::Int count,
+      bool fromHistory, const std::string& format, const Ice::Current& c);
+  void getRawFrame_async(
+      const v4l2server::AMD_CaptureCamera_getRawFramePtr& cb,
+      const Ice::Current& c);
+  void reconfigure_async(
+      const v4l2server::AMD_CaptureCamera_reconfigurePtr& cb, Ice::Int width,
+      Ice::Int height, Ice::Int fps, const Ice::Current& c);
+  void getFrameStatistics_async(
+      const v4l2server::AMD_CaptureCamera_getFrameStatisticsPtr& cb,
+      const Ice::Current& c);
+  virtual void subscribe(const v4l2server::FrameConsumerPrx& consumer,
+                         const std::string& format, const Ice::Current& c);
+  virtual void unsubscribe(const v4l2server::FrameConsumerPrx& consumer,
+                           const Ice::Current& c);
+  virtual std::string triggerRecording(const Ice::Current& c);
+  virtual void setTracing(bool enabled, const Ice::Current& c);
+  virtual std::string dumpTrace(const Ice::Current& c);
+  virtual v4l2server::CompressionMetrics getCompressionMetrics(
+      const Ice::Current& c);
+  int requestedQuality(const Ice::Current& c);
+  jderobot::ImageDescriptionPtr description();
+  void setFormat(const v4l2::Format& newFormat);
   virtual std::string startCameraStreaming(const Ice::Current&);
   virtual void stopCameraStreaming(const Ice::Current&);
   virtual void reset(const Ice::Current&);
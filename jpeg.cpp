@@ -0,0 +1,201 @@
+/*
+ * jpeg.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <jpeglib.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "jpeg.h"
+
+namespace v4l2 {
+
+/** Initial size of output buffer when it has no capacity yet */
+static const size_t kInitialOutputSize = 64 * 1024;
+
+/** libjpeg destination manager writing into a std::vector */
+struct VectorDestination {
+  struct jpeg_destination_mgr manager;
+  std::vector<unsigned char>* output;
+};
+
+/** libjpeg error manager returning control to Encode() instead of exit() */
+struct JpegError {
+  struct jpeg_error_mgr manager;
+  jmp_buf jump;
+};
+
+struct JpegContext {
+  struct jpeg_compress_struct compressor;
+  struct JpegError error;
+  struct VectorDestination destination;
+};
+
+static void InitDestination(j_compress_ptr compressor) {
+  VectorDestination* destination = (VectorDestination*) compressor->dest;
+  std::vector<unsigned char>* output = destination->output;
+  /* Reuse all memory already reserved by previous frames */
+  if (output->capacity() < kInitialOutputSize) {
+    output->resize(kInitialOutputSize);
+  } else {
+    output->resize(output->capacity());
+  }
+  destination->manager.next_output_byte = &(*output)[0];
+  destination->manager.free_in_buffer = output->size();
+}
+
+static boolean EmptyOutputBuffer(j_compress_ptr compressor) {
+  VectorDestination* destination = (VectorDestination*) compressor->dest;
+  std::vector<unsigned char>* output = destination->output;
+  /* libjpeg only calls us when the whole buffer is full */
+  size_t used = output->size();
+  output->resize(used * 2);
+  destination->manager.next_output_byte = &(*output)[used];
+  destination->manager.free_in_buffer = output->size() - used;
+  return TRUE;
+}
+
+static void TermDestination(j_compress_ptr compressor) {
+  VectorDestination* destination = (VectorDestination*) compressor->dest;
+  destination->output->resize(
+      destination->output->size() - destination->manager.free_in_buffer);
+}
+
+static void ErrorExit(j_common_ptr compressor) {
+  JpegError* error = (JpegError*) compressor->err;
+  longjmp(error->jump, 1);
+}
+
+JpegEncoder::JpegEncoder() {
+  context_ = new JpegContext();
+  context_->compressor.err = jpeg_std_error(&context_->error.manager);
+  context_->error.manager.error_exit = ErrorExit;
+  jpeg_create_compress(&context_->compressor);
+  context_->destination.manager.init_destination = InitDestination;
+  context_->destination.manager.empty_output_buffer = EmptyOutputBuffer;
+  context_->destination.manager.term_destination = TermDestination;
+  context_->compressor.dest = &context_->destination.manager;
+}
+
+JpegEncoder::~JpegEncoder() {
+  jpeg_destroy_compress(&context_->compressor);
+  delete context_;
+}
+
+/**
+ * Encode a YUYV frame as JPEG
+ * @param frame YUYV image data
+ * @param format image size of frame
+ * @param quality JPEG quality (1-100)
+ * @param output encoded image; its memory is reused between calls
+ * @param statistics if not NULL, filled with luma statistics of frame
+ * @return size in bytes of encoded image
+ */
+size_t JpegEncoder::Encode(Buffer* frame, Format* format, int quality,
+                           std::vector<unsigned char>* output,
+                           FrameStatistics* statistics) throw (std::string) {
+  struct jpeg_compress_struct* compressor = &context_->compressor;
+  int width = format->width;
+  int height = format->height;
+  if (frame->size < (size_t) (width * height * 2)) {
+    std::ostringstream output_message;
+    output_message << "(JpegEncoder) Frame too small: " << frame->size
+                   << " bytes for " << width << "x" << height << " YUYV";
+    throw std::string(output_message.str());
+  }
+  /* Raw data rows must cover whole MCUs (16x8 pixels for 4:2:2) */
+  int luma_width = (width + 15) & ~15;
+  int chroma_width = luma_width / 2;
+  strip_.resize(DCTSIZE * (luma_width + 2 * chroma_width));
+  JSAMPROW luma_rows[DCTSIZE], cb_rows[DCTSIZE], cr_rows[DCTSIZE];
+  for (int row = 0; row < DCTSIZE; row++) {
+    luma_rows[row] = &strip_[row * luma_width];
+    cb_rows[row] = &strip_[DCTSIZE * luma_width + row * chroma_width];
+    cr_rows[row] = &strip_[DCTSIZE * (luma_width + chroma_width)
+        + row * chroma_width];
+  }
+  JSAMPARRAY planes[3] = { luma_rows, cb_rows, cr_rows };
+
+  context_->destination.output = output;
+  if (setjmp(context_->error.jump)) {
+    char message[JMSG_LENGTH_MAX];
+    (*compressor->err->format_message)((j_common_ptr) compressor, message);
+    jpeg_abort_compress(compressor);
+    throw std::string("(JpegEncoder) ") + message;
+  }
+  compressor->image_width = width;
+  compressor->image_height = height;
+  compressor->input_components = 3;
+  compressor->in_color_space = JCS_YCbCr;
+  jpeg_set_defaults(compressor);
+  jpeg_set_colorspace(compressor, JCS_YCbCr);
+  jpeg_set_quality(compressor, quality, TRUE);
+  compressor->raw_data_in = TRUE;
+  compressor->dct_method = JDCT_IFAST;
+  /* YUYV is 4:2:2: full horizontal luma, half horizontal chroma */
+  compressor->comp_info[0].h_samp_factor = 2;
+  compressor->comp_info[0].v_samp_factor = 1;
+  compressor->comp_info[1].h_samp_factor = 1;
+  compressor->comp_info[1].v_samp_factor = 1;
+  compressor->comp_info[2].h_samp_factor = 1;
+  compressor->comp_info[2].v_samp_factor = 1;
+  jpeg_start_compress(compressor, TRUE);
+  if (statistics != NULL) {
+    statistics->Start(frame);
+  }
+
+  const unsigned char* yuyv_image = (const unsigned char*) frame->mem;
+  while (compressor->next_scanline < compressor->image_height) {
+    /* Split next 8 YUYV rows into planes (last row repeated at the end) */
+    for (int row = 0; row < DCTSIZE; row++) {
+      int source_row = compressor->next_scanline + row;
+      bool padding = source_row >= height;
+      if (padding) {
+        source_row = height - 1;
+      }
+      const unsigned char* yuyv = yuyv_image + source_row * width * 2;
+      JSAMPROW luma = luma_rows[row];
+      JSAMPROW cb = cb_rows[row];
+      JSAMPROW cr = cr_rows[row];
+      int x;
+      if (statistics != NULL && !padding) {
+        for (x = 0; x < width / 2; x++, yuyv += 4) {
+          luma[2 * x] = yuyv[0];
+          cb[x] = yuyv[1];
+          luma[2 * x + 1] = yuyv[2];
+          cr[x] = yuyv[3];
+          statistics->Add(yuyv[0]);
+          statistics->Add(yuyv[2]);
+        }
+      } else {
+        for (x = 0; x < width / 2; x++, yuyv += 4) {
+          luma[2 * x] = yuyv[0];
+          cb[x] = yuyv[1];
+          luma[2 * x + 1] = yuyv[2];
+          cr[x] = yuyv[3];
+        }
+      }
+      /* Pad to MCU width repeating last column */
+      for (; x < chroma_width; x++) {
+        luma[2 * x] = luma[2 * x + 1] = luma[width - 1];
+        cb[x] = cb[width / 2 - 1];
+        cr[x] = cr[width / 2 - 1];
+      }
+    }
+    jpeg_write_raw_data(compressor, planes, DCTSIZE);
+  }
+  jpeg_finish_compress(compressor);
+  if (statistics != NULL) {
+    statistics->Finish();
+  }
+  return output->size();
+}
+
+} /* namespace */
@@ -0,0 +1,44 @@
+/*
+ * jpeg.h
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#ifndef JDEROBOT_COMPONENTS_V4L2SERVER_JPEG_H_
+#define JDEROBOT_COMPONENTS_V4L2SERVER_JPEG_H_
+
+#include <string>
+#include <vector>
+
+#include "statistics.h"
+#include "v4l2.h"
+
+namespace v4l2 {
+
+struct JpegContext;
+
+/**
+ * YUYV to JPEG encoder
+ * Frames are fed to libjpeg as raw 4:2:2 YCbCr data, so there is no
+ * intermediate RGB image: only a strip of 8 planar rows is kept between the
+ * V4L2 buffer and the compressor.
+ */
+class JpegEncoder {
+ private:
+  /** libjpeg compressor state (reused between frames) */
+  JpegContext* context_;
+  /** Planar Y, Cb and Cr rows of current strip */
+  std::vector<unsigned char> strip_;
+
+ public:
+  JpegEncoder();
+  ~JpegEncoder();
+  size_t Encode(Buffer* frame, Format* format, int quality,
+                std::vector<unsigned char>* output,
+                FrameStatistics* statistics = NULL) throw (std::string);
+};
+
+} /* namespace */
+
+#endif /* JDEROBOT_COMPONENTS_V4L2SERVER_JPEG_H_ */
@@ -0,0 +1,191 @@
+/*
+ * ring.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <string.h>
+#include <fstream>
+#include <string>
+
+#include "ring.h"
+
+namespace v4l2 {
+
+static long long Timestamp(const struct timeval& timestamp) {
+  return (long long) timestamp.tv_sec * 1000000 + timestamp.tv_usec;
+}
+
+/**
+ * Constructor
+ * @param budget bytes of frame data kept
+ * @param max_frames maximum number of frames kept
+ */
+FrameRing::FrameRing(size_t budget, int max_frames)
+    : arena_(budget),
+      entries_(max_frames > 0 ? max_frames : 1),
+      first_(0),
+      count_(0),
+      head_(0),
+      next_id_(0) {
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+FrameRing::~FrameRing() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+void FrameRing::DropOldest() {
+  first_ = (first_ + 1) % entries_.size();
+  count_--;
+}
+
+/**
+ * Store a compressed frame, dropping the oldest ones to make room for it
+ * Frames larger than the whole arena are discarded.
+ */
+void FrameRing::Push(const unsigned char* data, size_t size,
+                     unsigned int sequence,
+                     const struct timeval& timestamp) {
+  if (size == 0 || size > arena_.size()) {
+    return;
+  }
+  pthread_mutex_lock(&mutex_);
+  /* Frames are never split: wrap to arena start if it doesn't fit */
+  if (head_ + size > arena_.size()) {
+    /* Frames left between head and arena end are the oldest ones */
+    while (count_ > 0 && entries_[first_].offset >= head_) {
+      DropOldest();
+    }
+    head_ = 0;
+  }
+  /* Stored frames follow head_ in arena, oldest first */
+  while (count_ > 0) {
+    Entry* oldest = &entries_[first_];
+    bool overlaps = oldest->offset < head_ + size
+        && oldest->offset + oldest->size > head_;
+    if (!overlaps && count_ < (int) entries_.size()) {
+      break;
+    }
+    DropOldest();
+  }
+  Entry* entry = &entries_[(first_ + count_) % entries_.size()];
+  entry->id = next_id_++;
+  entry->offset = head_;
+  entry->size = size;
+  entry->sequence = sequence;
+  entry->timestamp = timestamp;
+  memcpy(&arena_[head_], data, size);
+  head_ += size;
+  count_++;
+  pthread_mutex_unlock(&mutex_);
+}
+
+/**
+ * Get ids of stored frames captured since a given time
+ * @param since V4L2 timestamp (microseconds) of first frame wanted
+ * @return false if there is no such frame
+ */
+bool FrameRing::Window(long long since, unsigned long long* first,
+                       unsigned long long* last) {
+  bool found = false;
+  pthread_mutex_lock(&mutex_);
+  for (int i = 0; i < count_; i++) {
+    Entry* entry = &entries_[(first_ + i) % entries_.size()];
+    if (Timestamp(entry->timestamp) >= since) {
+      *first = entry->id;
+      *last = next_id_ - 1;
+      found = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+  return found;
+}
+
+/**
+ * Copy a stored frame
+ * @param id frame id
+ * @param data frame data (its memory is reused between calls)
+ * @param frame sequence number, timestamp and size of frame
+ * @return false if frame was already dropped
+ */
+bool FrameRing::Read(unsigned long long id, std::vector<unsigned char>* data,
+                     Buffer* frame) {
+  pthread_mutex_lock(&mutex_);
+  if (count_ == 0 || id < entries_[first_].id || id >= next_id_) {
+    pthread_mutex_unlock(&mutex_);
+    return false;
+  }
+  Entry* entry = &entries_[(first_ + (id - entries_[first_].id))
+      % entries_.size()];
+  data->resize(entry->size);
+  memcpy(&(*data)[0], &arena_[entry->offset], entry->size);
+  frame->size = entry->size;
+  frame->sequence = entry->sequence;
+  frame->timestamp = entry->timestamp;
+  pthread_mutex_unlock(&mutex_);
+  return true;
+}
+
+/**
+ * Write stored frames to disk
+ * Frames are concatenated in path + ".mjpg", and path + ".txt" gets one
+ * line per frame with its sequence number, V4L2 timestamp (microseconds),
+ * offset and size.
+ * Frames are copied out one at a time, so capture is never held for long.
+ * @return number of frames written (frames dropped meanwhile are skipped)
+ */
+int FrameRing::Dump(const std::string& path, unsigned long long first,
+                    unsigned long long last) throw (std::string) {
+  std::ofstream video((path + ".mjpg").c_str(), std::ofstream::binary);
+  std::ofstream index((path + ".txt").c_str());
+  if (!video || !index) {
+    throw std::string("(FrameRing) Can't create " + path);
+  }
+  std::vector<unsigned char> data;
+  Buffer frame;
+  long long offset = 0;
+  int written = 0;
+  for (unsigned long long id = first; id <= last; id++) {
+    if (!Read(id, &data, &frame)) {
+      continue;
+    }
+    video.write((char*) &data[0], data.size());
+    index << frame.sequence << " " << Timestamp(frame.timestamp) << " "
+          << offset << " " << data.size() << '\n';
+    offset += data.size();
+    written++;
+  }
+  video.flush();
+  index.flush();
+  if (!video) {
+    throw std::string("(FrameRing) Error writing " + path + ".mjpg");
+  }
+  if (!index) {
+    throw std::string("(FrameRing) Error writing " + path + ".txt");
+  }
+  return written;
+}
+
+/** Bytes of frame data stored */
+size_t FrameRing::bytes() {
+  size_t total = 0;
+  pthread_mutex_lock(&mutex_);
+  for (int i = 0; i < count_; i++) {
+    total += entries_[(first_ + i) % entries_.size()].size;
+  }
+  pthread_mutex_unlock(&mutex_);
+  return total;
+}
+
+/** Number of frames stored */
+int FrameRing::frames() {
+  pthread_mutex_lock(&mutex_);
+  int frames = count_;
+  pthread_mutex_unlock(&mutex_);
+  return frames;
+}
+
+} /* namespace */
@@ -0,0 +1,65 @@
+/*
+ * ring.h
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#ifndef JDEROBOT_COMPONENTS_V4L2SERVER_RING_H_
+#define JDEROBOT_COMPONENTS_V4L2SERVER_RING_H_
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "v4l2.h"
+
+namespace v4l2 {
+
+/**
+ * Recent compressed frames kept in memory (pre-event recording)
+ * Frame data is written into a single arena sized by a byte budget, so
+ * nothing is allocated per frame: the oldest frames are dropped to make
+ * room for new ones. Frames are identified by an increasing id, which lets
+ * a reader copy them out one at a time while capture goes on.
+ */
+class FrameRing {
+ private:
+  struct Entry {
+    unsigned long long id;
+    size_t offset;
+    size_t size;
+    unsigned int sequence;
+    struct timeval timestamp;
+  };
+  pthread_mutex_t mutex_;
+  std::vector<unsigned char> arena_;
+  /** Circular list of stored frames, oldest at first_ */
+  std::vector<Entry> entries_;
+  int first_;
+  int count_;
+  /** Next write offset in arena */
+  size_t head_;
+  /** Id of next frame */
+  unsigned long long next_id_;
+
+  void DropOldest();
+
+ public:
+  FrameRing(size_t budget, int max_frames);
+  ~FrameRing();
+  void Push(const unsigned char* data, size_t size, unsigned int sequence,
+            const struct timeval& timestamp);
+  bool Window(long long since, unsigned long long* first,
+              unsigned long long* last);
+  bool Read(unsigned long long id, std::vector<unsigned char>* data,
+            Buffer* frame);
+  int Dump(const std::string& path, unsigned long long first,
+           unsigned long long last) throw (std::string);
+  size_t bytes();
+  int frames();
+};
+
+} /* namespace */
+
+#endif /* JDEROBOT_COMPONENTS_V4L2SERVER_RING_H_ */
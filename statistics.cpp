@@ -0,0 +1,53 @@
+/*
+ * statistics.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <string.h>
+
+#include "statistics.h"
+
+namespace v4l2 {
+
+/** Clear statistics before adding samples of a frame */
+void FrameStatistics::Start(Buffer* frame) {
+  valid = false;
+  sequence = frame->sequence;
+  timestamp = frame->timestamp;
+  memset(histogram, 0, sizeof(histogram));
+  sum1 = 0;
+  sum2 = 0;
+}
+
+/** Compute mean, variance and checksum once every sample was added */
+void FrameStatistics::Finish() {
+  unsigned long long pixels = 0, sum = 0, squares = 0;
+  for (unsigned long long luma = 0; luma < 256; luma++) {
+    pixels += histogram[luma];
+    sum += histogram[luma] * luma;
+    squares += histogram[luma] * luma * luma;
+  }
+  mean = pixels ? (double) sum / pixels : 0;
+  variance = pixels ? (double) squares / pixels - mean * mean : 0;
+  checksum = (unsigned int) ((sum2 << 16) ^ sum1 ^ (sum2 >> 32));
+  valid = true;
+}
+
+/**
+ * Compute statistics of a YUYV frame in a pass of its own
+ * Used when the frame is not converted, as when it is sent as YUYV.
+ */
+void ComputeStatistics(Buffer* frame, FrameStatistics* statistics) {
+  const unsigned char* yuyv = (const unsigned char*) frame->mem;
+  const unsigned char* end = yuyv + (frame->size & ~3);
+  statistics->Start(frame);
+  for (; yuyv < end; yuyv += 4) {
+    statistics->Add(yuyv[0]);
+    statistics->Add(yuyv[2]);
+  }
+  statistics->Finish();
+}
+
+} /* namespace */
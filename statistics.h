@@ -0,0 +1,49 @@
+/*
+ * statistics.h
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#ifndef JDEROBOT_COMPONENTS_V4L2SERVER_STATISTICS_H_
+#define JDEROBOT_COMPONENTS_V4L2SERVER_STATISTICS_H_
+
+#include "v4l2.h"
+
+namespace v4l2 {
+
+/**
+ * Luma statistics of a frame
+ * Meant to be filled by the pass that converts or encodes the frame, so they
+ * cost no extra pass over frame memory: Add() is called for every luma
+ * sample and Finish() derives mean and variance from the histogram.
+ */
+struct FrameStatistics {
+  /** Statistics computed for frame with this sequence number */
+  bool valid;
+  unsigned int sequence;
+  struct timeval timestamp;
+  unsigned int histogram[256];
+  double mean;
+  double variance;
+  /** Fletcher checksum of luma: equal on consecutive frames if frozen */
+  unsigned int checksum;
+  /** Running sums of checksum (not the type of histogram bins, so compilers
+   * can keep them in registers while bins are written) */
+  unsigned long long sum1;
+  unsigned long long sum2;
+
+  void Start(Buffer* frame);
+  inline void Add(unsigned char luma) {
+    histogram[luma]++;
+    sum1 += luma;
+    sum2 += sum1;
+  }
+  void Finish();
+};
+
+void ComputeStatistics(Buffer* frame, FrameStatistics* statistics);
+
+} /* namespace */
+
+#endif /* JDEROBOT_COMPONENTS_V4L2SERVER_STATISTICS_H_ */
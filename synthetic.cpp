@@ -0,0 +1,224 @@
+/*
+ * synthetic.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <sstream>
+#include <string>
+
+#include "synthetic.h"
+
+namespace v4l2 {
+
+SyntheticCamera::SyntheticCamera(Format* format, int fps)
+    : Camera("synthetic", format, fps),
+      timer_fd_(-1),
+      ready_fd_(-1),
+      epoll_fd_(-1),
+      interval_(0),
+      sequence_(0),
+      frame_held_(false) {
+}
+
+SyntheticCamera::~SyntheticCamera() {
+  Close();
+}
+
+void SyntheticCamera::Open() throw (std::string) {
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  ready_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (timer_fd_ == -1 || ready_fd_ == -1 || epoll_fd_ == -1) {
+    std::string error = strerror(errno);
+    Close();
+    throw std::string("(SyntheticCamera) Can't create timer descriptors: ")
+        + error;
+  }
+  int fds[] = { timer_fd_, ready_fd_ };
+  for (int i = 0; i < 2; i++) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fds[i];
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fds[i], &event) == -1) {
+      std::string error = strerror(errno);
+      Close();
+      throw std::string("(SyntheticCamera) Can't poll timer: ") + error;
+    }
+  }
+}
+
+void SyntheticCamera::Close() {
+  initialized_ = false;
+  streaming_ = false;
+  ready_.clear();
+  int* fds[] = { &epoll_fd_, &ready_fd_, &timer_fd_ };
+  for (int i = 0; i < 3; i++) {
+    if (*fds[i] != -1) {
+      close(*fds[i]);
+      *fds[i] = -1;
+    }
+  }
+}
+
+/** Make descriptor readable while frames are queued, and only then */
+void SyntheticCamera::SignalReady() {
+  uint64_t value = 1;
+  if (ready_.empty()) {
+    /* Nonblocking read: clears it, fails if not set */
+    ssize_t result = read(ready_fd_, &value, sizeof(value));
+    (void) result;
+  } else {
+    /* Counter is only checked for non-zero, so writing twice is harmless */
+    ssize_t result = write(ready_fd_, &value, sizeof(value));
+    (void) result;
+  }
+}
+
+/** Draw a test pattern (gradients) of current image size */
+void SyntheticCamera::Initialize() throw (std::string) {
+  int width = format_->width;
+  int height = format_->height;
+  image_.resize(width * height * 2);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x += 2) {
+      unsigned char* pixels = &image_[(y * width + x) * 2];
+      pixels[0] = (x + y) & 0xff;
+      pixels[1] = (128 + x / 8) & 0xff;
+      pixels[2] = (x + y + 1) & 0xff;
+      pixels[3] = (128 + y / 8) & 0xff;
+    }
+  }
+  num_buffers_ = requested_buffers_;
+  initialized_ = true;
+}
+
+void SyntheticCamera::Start() throw (std::string) {
+  struct itimerspec period;
+  memset(&period, 0, sizeof(period));
+  long interval = 1000000000L / (format_->fps > 0 ? format_->fps : 1);
+  period.it_interval.tv_sec = interval / 1000000000L;
+  period.it_interval.tv_nsec = interval % 1000000000L;
+  period.it_value = period.it_interval;
+  interval_ = interval / 1000;
+  ready_.clear();
+  SignalReady();
+  if (timerfd_settime(timer_fd_, 0, &period, NULL) == -1) {
+    throw std::string("(SyntheticCamera) Can't start timer: ")
+        + strerror(errno);
+  }
+  /* Sequence numbers go on across restarts, as Camera ones */
+  streaming_ = true;
+}
+
+void SyntheticCamera::Stop() throw (std::string) {
+  struct itimerspec period;
+  memset(&period, 0, sizeof(period));
+  timerfd_settime(timer_fd_, 0, &period, NULL);
+  ready_.clear();
+  SignalReady();
+  streaming_ = false;
+}
+
+/** Any even size and frame rate up to 120 fps */
+bool SyntheticCamera::IsSupported(Format* format) throw (std::string) {
+  return format->format == "YUYV" && format->width > 0
+      && format->width % 2 == 0 && format->height > 0 && format->fps > 0
+      && format->fps <= 120;
+}
+
+/** Readable on timer ticks and while frames are queued */
+int SyntheticCamera::fd() {
+  return epoll_fd_;
+}
+
+bool SyntheticCamera::is_active() {
+  return initialized_ && epoll_fd_ != -1;
+}
+
+/** Frames captured and not dequeued yet */
+long SyntheticCamera::queued() {
+  return ready_.size();
+}
+
+/**
+ * Dequeue next frame, waiting for a timer tick if none is queued
+ * Ticks found when the queue is full are dropped frames: sequence numbers
+ * skip them, as V4L2 ones skip frames lost by the driver. In latest frame
+ * mode the newest queued frame is returned and the older ones are skipped.
+ */
+Buffer* SyntheticCamera::WaitFrame(int milliseconds) throw (std::string) {
+  if (frame_held_) {
+    throw std::string("ERROR: Previous frame wasn't freed!");
+  }
+  struct pollfd ufds[1];
+  ufds[0].fd = timer_fd_;
+  ufds[0].events = POLLIN;
+  int result = poll(ufds, 1, ready_.empty() ? milliseconds : 0);
+  if (result == -1) {
+    std::ostringstream output_message;
+    output_message << "Error waiting for synthetic frame: [" << errno << "] "
+                   << strerror(errno);
+    throw std::string(output_message.str());
+  }
+  uint64_t ticks;
+  if (result == 1 && read(timer_fd_, &ticks, sizeof(ticks)) == sizeof(ticks)) {
+    /* Ticks were one period apart, last one just now */
+    long long now = MonotonicTime();
+    for (uint64_t tick = 0; tick < ticks; tick++) {
+      ReadyFrame ready;
+      ready.sequence = sequence_++;
+      ready.timestamp = now - (long long) (ticks - 1 - tick) * interval_;
+      if (ready_.size() < (size_t) num_buffers_) {
+        ready_.push_back(ready);
+      }
+    }
+  }
+  if (ready_.empty()) {
+    return NULL;
+  }
+  while (latest_frame_ && ready_.size() > 1) {
+    ready_.pop_front();
+    skipped_frames_++;
+  }
+  ReadyFrame ready = ready_.front();
+  ready_.pop_front();
+  SignalReady();
+  Buffer* frame = new Buffer;
+  frame->index = 0;
+  frame->mem = &image_[0];
+  frame->size = frame->used = image_.size();
+  frame->sequence = ready.sequence;
+  frame->timestamp.tv_sec = ready.timestamp / 1000000;
+  frame->timestamp.tv_usec = ready.timestamp % 1000000;
+  /* Change a few pixels, so frame checksums differ as in a live scene */
+  memcpy(&image_[0], &ready.sequence, sizeof(ready.sequence));
+  frame_held_ = true;
+  return frame;
+}
+
+void SyntheticCamera::FreeFrame(Buffer* frame) throw (std::string) {
+  delete frame;
+  frame_held_ = false;
+}
+
+/** Camera for a server Uri: a device path, or "synthetic" */
+Camera* NewCamera(const std::string& uri, Format* format, int fps) {
+  if (uri == "synthetic") {
+    return new SyntheticCamera(format, fps);
+  }
+  return new Camera(uri, format, fps);
+}
+
+} /* namespace */
@@ -0,0 +1,71 @@
+/*
+ * synthetic.h
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#ifndef JDEROBOT_COMPONENTS_V4L2SERVER_SYNTHETIC_H_
+#define JDEROBOT_COMPONENTS_V4L2SERVER_SYNTHETIC_H_
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "v4l2.h"
+
+namespace v4l2 {
+
+/**
+ * Camera generating YUYV frames without a device (Uri "synthetic")
+ * Frames are paced by a timer file descriptor, so the server sleeps and wakes
+ * up as it does with a real camera: used to profile it on any machine.
+ * As a driver does, it queues up to num_buffers() frames the server hasn't
+ * dequeued yet and drops new ones while the queue is full; its descriptor is
+ * readable while frames are queued, as a V4L2 one with buffers done.
+ */
+class SyntheticCamera : public Camera {
+ private:
+  /** Frame captured and not dequeued yet */
+  struct ReadyFrame {
+    unsigned int sequence;
+    long long timestamp;
+  };
+
+  /** timerfd ticking at frame rate */
+  int timer_fd_;
+  /** eventfd readable while frames are queued */
+  int ready_fd_;
+  /** epoll of both, given to pollers as the camera descriptor */
+  int epoll_fd_;
+  /** Timer period (microseconds) */
+  long long interval_;
+  std::vector<unsigned char> image_;
+  unsigned int sequence_;
+  std::deque<ReadyFrame> ready_;
+  /** A frame was returned by WaitFrame and not freed yet */
+  bool frame_held_;
+
+  void SignalReady();
+
+ public:
+  SyntheticCamera(Format* format, int fps);
+  virtual ~SyntheticCamera();
+  virtual void Open() throw (std::string);
+  virtual void Close();
+  virtual void Initialize() throw (std::string);
+  virtual void Start() throw (std::string);
+  virtual void Stop() throw (std::string);
+  virtual bool IsSupported(Format* format) throw (std::string);
+  virtual int fd();
+  virtual bool is_active();
+  long queued();
+  virtual Buffer* WaitFrame(int timeout) throw (std::string);
+  virtual void FreeFrame(Buffer* frame) throw (std::string);
+};
+
+Camera* NewCamera(const std::string& uri, Format* format, int fps);
+
+} /* namespace */
+
+#endif /* JDEROBOT_COMPONENTS_V4L2SERVER_SYNTHETIC_H_ */
@@ -0,0 +1,132 @@
+/*
+ * buffers_test.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <unistd.h>
+
+#include "buffers.h"
+#include "check.h"
+
+/** Frames dequeued before each decision (kWindowFrames) */
+static const int kWindow = 300;
+
+/**
+ * Feed a whole window of frames to controller
+ * @param drops frames lost by the driver in the window
+ * @param hold_us time each frame is held before release
+ * @param age_us time each frame waited in the queue before dequeue
+ */
+static void RunWindow(v4l2::BufferController* controller,
+                      unsigned int* sequence, int drops, int hold_us,
+                      int age_us = 0) {
+  v4l2::Buffer frame;
+  frame.index = 0;
+  frame.mem = NULL;
+  frame.size = frame.used = 0;
+  for (int i = 0; i < kWindow; i++) {
+    *sequence += i == kWindow / 2 ? 1 + drops : 1;
+    frame.sequence = *sequence;
+    long long captured = v4l2::MonotonicTime() - age_us;
+    frame.timestamp.tv_sec = captured / 1000000;
+    frame.timestamp.tv_usec = captured % 1000000;
+    controller->OnDequeue(&frame);
+    if (hold_us > 0) {
+      usleep(hold_us);
+    }
+    controller->OnRelease();
+  }
+}
+
+static void TestNoDecisionBeforeWindowEnd() {
+  v4l2::BufferController controller(2, 6, 30);
+  unsigned int sequence = 0;
+  v4l2::Buffer frame;
+  frame.sequence = 0;
+  frame.timestamp.tv_sec = frame.timestamp.tv_usec = 0;
+  controller.OnDequeue(&frame);
+  controller.OnRelease();
+  CHECK_EQUAL(4, controller.Decide(4));
+  RunWindow(&controller, &sequence, 5, 0);
+  CHECK_EQUAL(5, controller.Decide(4));
+}
+
+/**
+ * Removal needs quiet windows, and no change follows another at once
+ * (frames held shortly: 3 buffers required, plus one as margin)
+ */
+static void TestQuietWindowsAndCooldown() {
+  v4l2::BufferController controller(2, 6, 30);
+  unsigned int sequence = 0;
+  RunWindow(&controller, &sequence, 0, 0);
+  CHECK_EQUAL(5, controller.Decide(5));
+  RunWindow(&controller, &sequence, 0, 0);
+  CHECK_EQUAL(4, controller.Decide(5));
+  /* Drops in cooldown windows are ignored */
+  RunWindow(&controller, &sequence, 3, 0);
+  CHECK_EQUAL(4, controller.Decide(4));
+  RunWindow(&controller, &sequence, 3, 0);
+  CHECK_EQUAL(4, controller.Decide(4));
+  RunWindow(&controller, &sequence, 3, 0);
+  CHECK_EQUAL(5, controller.Decide(4));
+  /* Cooldown windows don't count as quiet ones */
+  for (int window = 0; window < 3; window++) {
+    RunWindow(&controller, &sequence, 0, 0);
+    CHECK_EQUAL(5, controller.Decide(5));
+  }
+  RunWindow(&controller, &sequence, 0, 0);
+  CHECK_EQUAL(4, controller.Decide(5));
+  /* No removal leaving no spare buffer */
+  for (int window = 0; window < 6; window++) {
+    RunWindow(&controller, &sequence, 0, 0);
+    CHECK_EQUAL(4, controller.Decide(4));
+  }
+}
+
+static void TestBounds() {
+  v4l2::BufferController controller(3, 4, 30);
+  unsigned int sequence = 0;
+  RunWindow(&controller, &sequence, 2, 0);
+  CHECK_EQUAL(4, controller.Decide(4));
+  for (int window = 0; window < 4; window++) {
+    RunWindow(&controller, &sequence, 0, 0);
+    CHECK_EQUAL(3, controller.Decide(3));
+  }
+}
+
+/** A buffer is kept as margin over those covering the hold time */
+static void TestRemovalKeepsMargin() {
+  /* 1 ms frame period, frames held over 1 ms: 4 buffers required */
+  v4l2::BufferController controller(2, 8, 1000);
+  unsigned int sequence = 0;
+  for (int window = 0; window < 3; window++) {
+    RunWindow(&controller, &sequence, 0, 1100);
+    CHECK_EQUAL(5, controller.Decide(5));
+  }
+}
+
+/** Frames waiting in the queue over a frame period keep buffers */
+static void TestBacklogKeepsBuffers() {
+  v4l2::BufferController controller(2, 6, 30);
+  unsigned int sequence = 0;
+  for (int window = 0; window < 3; window++) {
+    RunWindow(&controller, &sequence, 0, 0, 70000);
+    CHECK_EQUAL(5, controller.Decide(5));
+  }
+  /* Quiet windows count again once the backlog is gone */
+  RunWindow(&controller, &sequence, 0, 0);
+  CHECK_EQUAL(5, controller.Decide(5));
+  RunWindow(&controller, &sequence, 0, 0);
+  CHECK_EQUAL(4, controller.Decide(5));
+}
+
+int main() {
+  TestNoDecisionBeforeWindowEnd();
+  TestQuietWindowsAndCooldown();
+  TestBounds();
+  TestRemovalKeepsMargin();
+  TestBacklogKeepsBuffers();
+  return CHECK_RESULT();
+}
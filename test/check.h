@@ -0,0 +1,39 @@
+/*
+ * check.h
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#ifndef JDEROBOT_COMPONENTS_V4L2SERVER_TEST_CHECK_H_
+#define JDEROBOT_COMPONENTS_V4L2SERVER_TEST_CHECK_H_
+
+#include <iostream>
+
+/** Failed checks of the test being run */
+static int check_failures = 0;
+
+/** Report a failed condition and go on with the test */
+#define CHECK(condition)                                                    \
+  do {                                                                      \
+    if (!(condition)) {                                                     \
+      std::cout << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition     \
+                << ") failed" << std::endl;                                 \
+      check_failures++;                                                     \
+    }                                                                       \
+  } while (0)
+
+#define CHECK_EQUAL(expected, actual)                                       \
+  do {                                                                      \
+    if (!((expected) == (actual))) {                                        \
+      std::cout << __FILE__ << ":" << __LINE__ << ": CHECK_EQUAL(" #expected \
+                << ", " #actual ") failed: " << (expected) << " != "        \
+                << (actual) << std::endl;                                   \
+      check_failures++;                                                     \
+    }                                                                       \
+  } while (0)
+
+/** Exit status of test executable */
+#define CHECK_RESULT() (check_failures == 0 ? 0 : 1)
+
+#endif /* JDEROBOT_COMPONENTS_V4L2SERVER_TEST_CHECK_H_ */
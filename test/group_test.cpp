@@ -0,0 +1,196 @@
+/*
+ * group_test.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <unistd.h>
+#include <vector>
+
+#include "check.h"
+#include "group.h"
+#include "synthetic.h"
+
+/** Reference of scripted timestamps (monotonic, microseconds) */
+static long long start_time;
+static v4l2::Format scripted_format;
+
+/**
+ * Camera returning frames with scripted timestamps
+ * Its descriptor is readable while frames are left.
+ */
+class ScriptedCamera : public v4l2::Camera {
+ private:
+  std::vector<long long> offsets_;
+  size_t next_;
+  int pipe_[2];
+
+ public:
+  int freed;
+
+  ScriptedCamera(const std::vector<long long>& offsets)
+      : Camera("scripted", &scripted_format, 30),
+        offsets_(offsets),
+        next_(0),
+        freed(0) {
+    char ready = 0;
+    if (pipe(pipe_) == -1 || write(pipe_[1], &ready, 1) != 1) {
+      pipe_[0] = pipe_[1] = -1;
+    }
+  }
+  virtual ~ScriptedCamera() {
+    close(pipe_[0]);
+    close(pipe_[1]);
+  }
+  virtual int fd() {
+    return pipe_[0];
+  }
+  virtual v4l2::Buffer* WaitFrame(int) throw (std::string) {
+    if (next_ == offsets_.size()) {
+      char ready;
+      if (read(pipe_[0], &ready, 1) != 1) {
+        throw std::string("Can't read pipe");
+      }
+      return NULL;
+    }
+    long long timestamp = start_time + offsets_[next_];
+    v4l2::Buffer* frame = new v4l2::Buffer;
+    frame->index = 0;
+    frame->mem = NULL;
+    frame->size = frame->used = 0;
+    frame->sequence = next_++;
+    frame->timestamp.tv_sec = timestamp / 1000000;
+    frame->timestamp.tv_usec = timestamp % 1000000;
+    return frame;
+  }
+  virtual void FreeFrame(v4l2::Buffer* frame) throw (std::string) {
+    delete frame;
+    freed++;
+  }
+};
+
+static std::vector<long long> Offsets(long long first, long long second = -1,
+                                      long long third = -1) {
+  std::vector<long long> offsets(1, first);
+  if (second != -1) {
+    offsets.push_back(second);
+  }
+  if (third != -1) {
+    offsets.push_back(third);
+  }
+  return offsets;
+}
+
+static long long Timestamp(v4l2::Buffer* frame) {
+  return (long long) frame->timestamp.tv_sec * 1000000
+      + frame->timestamp.tv_usec - start_time;
+}
+
+static void TestMatch() {
+  ScriptedCamera left(Offsets(0, 20000)), right(Offsets(1000));
+  std::vector<v4l2::Camera*> cameras;
+  cameras.push_back(&left);
+  cameras.push_back(&right);
+  v4l2::CameraGroup group(cameras, 5000);
+  std::vector<v4l2::Buffer*> frames;
+  CHECK(group.WaitFrames(100, &frames));
+  CHECK_EQUAL((size_t) 2, frames.size());
+  CHECK_EQUAL(0LL, Timestamp(frames[0]));
+  CHECK_EQUAL(1000LL, Timestamp(frames[1]));
+  group.FreeFrames();
+  CHECK_EQUAL(1, left.freed);
+  CHECK_EQUAL(1, right.freed);
+  CHECK_EQUAL(1L, group.matched_sets());
+  CHECK_EQUAL(0L, group.dropped_frames());
+  CHECK_EQUAL(1000.0, group.mean_skew());
+}
+
+/** Frames too old for the newest one of the set are dropped */
+static void TestDropUnmatched() {
+  ScriptedCamera left(Offsets(0, 20000)), right(Offsets(19000));
+  std::vector<v4l2::Camera*> cameras;
+  cameras.push_back(&left);
+  cameras.push_back(&right);
+  v4l2::CameraGroup group(cameras, 5000);
+  std::vector<v4l2::Buffer*> frames;
+  CHECK(group.WaitFrames(100, &frames));
+  CHECK_EQUAL(20000LL, Timestamp(frames[0]));
+  CHECK_EQUAL(19000LL, Timestamp(frames[1]));
+  CHECK_EQUAL(1L, group.dropped_frames());
+  group.FreeFrames();
+}
+
+/** Frames queued long before the request are discarded */
+static void TestStaleFrames() {
+  ScriptedCamera left(Offsets(-1000000, -980000, 0)), right(Offsets(0));
+  std::vector<v4l2::Camera*> cameras;
+  cameras.push_back(&left);
+  cameras.push_back(&right);
+  v4l2::CameraGroup group(cameras, 5000, 500000);
+  std::vector<v4l2::Buffer*> frames;
+  CHECK(group.WaitFrames(100, &frames));
+  CHECK_EQUAL(0LL, Timestamp(frames[0]));
+  CHECK_EQUAL(2L, group.stale_frames());
+  CHECK_EQUAL(0L, group.dropped_frames());
+  group.FreeFrames();
+  CHECK_EQUAL(3, left.freed);
+}
+
+static void TestTimeout() {
+  std::vector<long long> none;
+  ScriptedCamera left(Offsets(0)), right(none);
+  std::vector<v4l2::Camera*> cameras;
+  cameras.push_back(&left);
+  cameras.push_back(&right);
+  v4l2::CameraGroup group(cameras, 5000);
+  std::vector<v4l2::Buffer*> frames;
+  CHECK(!group.WaitFrames(50, &frames));
+  CHECK_EQUAL(0L, group.matched_sets());
+  group.FreeFrames();
+}
+
+/**
+ * Synthetic cameras at 50 fps with 3 buffers: frames queued while nobody
+ * asks are discarded as stale, and matching goes on with fresh ones
+ */
+static void TestSyntheticIdle() {
+  v4l2::Format format = scripted_format;
+  format.fps = 50;
+  v4l2::SyntheticCamera left(&format, 50), right(&format, 50);
+  std::vector<v4l2::Camera*> cameras;
+  cameras.push_back(&left);
+  cameras.push_back(&right);
+  for (size_t i = 0; i < cameras.size(); i++) {
+    cameras[i]->SetBufferCount(3);
+    cameras[i]->Open();
+    cameras[i]->Initialize();
+    cameras[i]->Start();
+  }
+  v4l2::CameraGroup group(cameras, 10000, 40000);
+  std::vector<v4l2::Buffer*> frames;
+  for (int round = 0; round < 3; round++) {
+    for (int set = 0; set < 10; set++) {
+      CHECK(group.WaitFrames(200, &frames));
+      group.FreeFrames();
+    }
+    usleep(500000);
+  }
+  CHECK_EQUAL(30L, group.matched_sets());
+  /* Three queued frames per camera after each idle period but the last */
+  CHECK(group.stale_frames() >= 12);
+}
+
+int main() {
+  scripted_format.format = "YUYV";
+  scripted_format.width = 320;
+  scripted_format.height = 240;
+  scripted_format.fps = 30;
+  start_time = v4l2::MonotonicTime();
+  TestMatch();
+  TestDropUnmatched();
+  TestStaleFrames();
+  TestTimeout();
+  TestSyntheticIdle();
+  return CHECK_RESULT();
+}
@@ -0,0 +1,90 @@
+/*
+ * history_test.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "history.h"
+
+/** Frame of size bytes filled with its sequence number */
+static v4l2::Buffer MakeFrame(std::vector<unsigned char>* data,
+                              unsigned int sequence, size_t size) {
+  data->assign(size, (unsigned char) sequence);
+  v4l2::Buffer frame;
+  frame.index = 0;
+  frame.mem = &(*data)[0];
+  frame.size = frame.used = size;
+  frame.sequence = sequence;
+  frame.timestamp.tv_sec = sequence;
+  frame.timestamp.tv_usec = 0;
+  return frame;
+}
+
+static void TestEmpty() {
+  v4l2::FrameHistory history(3, 16);
+  CHECK_EQUAL(0, history.size());
+  CHECK_EQUAL(3, history.capacity());
+  CHECK(history.Get(0) == NULL);
+}
+
+static void TestOrderAndWraparound() {
+  v4l2::FrameHistory history(3, 16);
+  std::vector<unsigned char> data;
+  for (unsigned int sequence = 1; sequence <= 5; sequence++) {
+    v4l2::Buffer frame = MakeFrame(&data, sequence, 8 + sequence);
+    history.Push(&frame);
+  }
+  CHECK_EQUAL(3, history.size());
+  for (int age = 0; age < 3; age++) {
+    v4l2::Buffer* frame = history.Get(age);
+    CHECK(frame != NULL);
+    if (frame == NULL) {
+      continue;
+    }
+    unsigned int sequence = 5 - age;
+    CHECK_EQUAL(sequence, frame->sequence);
+    CHECK_EQUAL((size_t) (8 + sequence), frame->size);
+    CHECK_EQUAL((long) sequence, (long) frame->timestamp.tv_sec);
+    CHECK_EQUAL((int) sequence, (int) ((unsigned char*) frame->mem)[0]);
+  }
+  CHECK(history.Get(3) == NULL);
+  CHECK(history.Get(-1) == NULL);
+}
+
+/** Frames are copied: the source buffer can be requeued */
+static void TestCopy() {
+  v4l2::FrameHistory history(2, 16);
+  std::vector<unsigned char> data;
+  v4l2::Buffer frame = MakeFrame(&data, 7, 16);
+  history.Push(&frame);
+  memset(&data[0], 0, data.size());
+  CHECK_EQUAL(7, (int) ((unsigned char*) history.Get(0)->mem)[15]);
+}
+
+static void TestOversizedFrame() {
+  v4l2::FrameHistory history(2, 16);
+  std::vector<unsigned char> data;
+  v4l2::Buffer frame = MakeFrame(&data, 1, 17);
+  bool thrown = false;
+  try {
+    history.Push(&frame);
+  } catch (std::string& e) {
+    thrown = true;
+  }
+  CHECK(thrown);
+  CHECK_EQUAL(0, history.size());
+}
+
+int main() {
+  TestEmpty();
+  TestOrderAndWraparound();
+  TestCopy();
+  TestOversizedFrame();
+  return CHECK_RESULT();
+}
@@ -0,0 +1,113 @@
+/*
+ * ring_test.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "ring.h"
+
+/** Push a frame of size bytes filled with its sequence number */
+static void Push(v4l2::FrameRing* ring, unsigned int sequence, size_t size) {
+  std::vector<unsigned char> data(size, (unsigned char) sequence);
+  struct timeval timestamp;
+  timestamp.tv_sec = sequence;
+  timestamp.tv_usec = 0;
+  ring->Push(&data[0], size, sequence, timestamp);
+}
+
+/** Oldest frames are dropped on wraparound, never over the byte budget */
+static void TestWraparound() {
+  v4l2::FrameRing ring(100, 100);
+  for (unsigned int sequence = 0; sequence < 50; sequence++) {
+    Push(&ring, sequence, 20 + sequence % 7 * 5);
+    CHECK(ring.bytes() <= 100);
+  }
+  /* Frames of up to 50 bytes: at least the last two fit */
+  CHECK(ring.frames() >= 2);
+  unsigned long long first, last;
+  CHECK(ring.Window(0, &first, &last));
+  CHECK_EQUAL(49ULL, last);
+  CHECK_EQUAL((unsigned long long) (50 - ring.frames()), first);
+  std::vector<unsigned char> data;
+  v4l2::Buffer frame;
+  for (unsigned long long id = first; id <= last; id++) {
+    CHECK(ring.Read(id, &data, &frame));
+    CHECK_EQUAL((unsigned int) id, frame.sequence);
+    CHECK_EQUAL((size_t) (20 + id % 7 * 5), data.size());
+    CHECK_EQUAL((int) id, (int) data[data.size() - 1]);
+  }
+  CHECK(!ring.Read(first - 1, &data, &frame));
+  CHECK(!ring.Read(last + 1, &data, &frame));
+}
+
+static void TestFrameLimitAndWindow() {
+  v4l2::FrameRing ring(1000, 4);
+  for (unsigned int sequence = 0; sequence < 10; sequence++) {
+    Push(&ring, sequence, 10);
+  }
+  CHECK_EQUAL(4, ring.frames());
+  CHECK_EQUAL((size_t) 40, ring.bytes());
+  unsigned long long first, last;
+  /* Timestamps are sequence numbers in seconds */
+  CHECK(ring.Window(8 * 1000000LL, &first, &last));
+  CHECK_EQUAL(8ULL, first);
+  CHECK_EQUAL(9ULL, last);
+  CHECK(!ring.Window(10 * 1000000LL, &first, &last));
+}
+
+static void TestOversizedFrame() {
+  v4l2::FrameRing ring(50, 10);
+  Push(&ring, 0, 20);
+  Push(&ring, 1, 51);
+  CHECK_EQUAL(1, ring.frames());
+}
+
+static void TestDump() {
+  v4l2::FrameRing ring(1000, 10);
+  for (unsigned int sequence = 0; sequence < 3; sequence++) {
+    Push(&ring, sequence, 10 + sequence);
+  }
+  std::ostringstream path;
+  path << "/tmp/ring_test-" << getpid();
+  int written = -1;
+  try {
+    written = ring.Dump(path.str(), 1, 2);
+  } catch (std::string& e) {
+    std::cout << "ERROR: " << e << std::endl;
+  }
+  CHECK_EQUAL(2, written);
+  std::ifstream index((path.str() + ".txt").c_str());
+  std::string line;
+  std::vector<std::string> lines;
+  while (std::getline(index, line)) {
+    lines.push_back(line);
+  }
+  CHECK_EQUAL((size_t) 2, lines.size());
+  if (lines.size() == 2) {
+    CHECK_EQUAL(std::string("1 1000000 0 11"), lines[0]);
+    CHECK_EQUAL(std::string("2 2000000 11 12"), lines[1]);
+  }
+  std::ifstream video((path.str() + ".mjpg").c_str(), std::ifstream::binary);
+  video.seekg(0, std::ifstream::end);
+  CHECK_EQUAL(23, (int) video.tellg());
+  unlink((path.str() + ".txt").c_str());
+  unlink((path.str() + ".mjpg").c_str());
+}
+
+int main() {
+  TestWraparound();
+  TestFrameLimitAndWindow();
+  TestOversizedFrame();
+  TestDump();
+  return CHECK_RESULT();
+}
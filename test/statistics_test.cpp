@@ -0,0 +1,108 @@
+/*
+ * statistics_test.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "jpeg.h"
+#include "statistics.h"
+
+static const int kWidth = 32;
+static const int kHeight = 16;
+
+/** YUYV frame alternating luma 10 and 20, with uniform chroma */
+static void FillFrame(std::vector<unsigned char>* yuyv, v4l2::Buffer* frame,
+                      unsigned char chroma) {
+  yuyv->resize(kWidth * kHeight * 2);
+  for (size_t i = 0; i < yuyv->size(); i += 4) {
+    (*yuyv)[i] = 10;
+    (*yuyv)[i + 1] = chroma;
+    (*yuyv)[i + 2] = 20;
+    (*yuyv)[i + 3] = chroma;
+  }
+  frame->index = 0;
+  frame->mem = &(*yuyv)[0];
+  frame->size = frame->used = yuyv->size();
+  frame->sequence = 3;
+  frame->timestamp.tv_sec = 1;
+  frame->timestamp.tv_usec = 2;
+}
+
+static void TestOwnPass() {
+  std::vector<unsigned char> yuyv;
+  v4l2::Buffer frame;
+  FillFrame(&yuyv, &frame, 128);
+  v4l2::FrameStatistics statistics;
+  v4l2::ComputeStatistics(&frame, &statistics);
+  CHECK(statistics.valid);
+  CHECK_EQUAL(3u, statistics.sequence);
+  CHECK_EQUAL(2, (int) statistics.timestamp.tv_usec);
+  CHECK_EQUAL((unsigned int) (kWidth * kHeight / 2), statistics.histogram[10]);
+  CHECK_EQUAL((unsigned int) (kWidth * kHeight / 2), statistics.histogram[20]);
+  CHECK_EQUAL(0u, statistics.histogram[128]);
+  CHECK_EQUAL(15.0, statistics.mean);
+  CHECK_EQUAL(25.0, statistics.variance);
+}
+
+/** Checksum only depends on luma */
+static void TestChecksum() {
+  std::vector<unsigned char> yuyv;
+  v4l2::Buffer frame;
+  v4l2::FrameStatistics first, second;
+  FillFrame(&yuyv, &frame, 128);
+  v4l2::ComputeStatistics(&frame, &first);
+  FillFrame(&yuyv, &frame, 90);
+  v4l2::ComputeStatistics(&frame, &second);
+  CHECK_EQUAL(first.checksum, second.checksum);
+  /* Same histogram, different luma order */
+  yuyv[0] = 20;
+  yuyv[2] = 10;
+  v4l2::ComputeStatistics(&frame, &second);
+  CHECK_EQUAL(first.mean, second.mean);
+  CHECK(first.checksum != second.checksum);
+}
+
+/** Statistics filled by conversion passes match those of their own pass */
+static void TestFusedPasses() {
+  std::vector<unsigned char> yuyv;
+  v4l2::Buffer frame;
+  FillFrame(&yuyv, &frame, 128);
+  yuyv[100] = 250;
+  v4l2::FrameStatistics expected, rgb_statistics, jpeg_statistics;
+  v4l2::ComputeStatistics(&frame, &expected);
+
+  v4l2::Format format;
+  format.format = "YUYV";
+  format.width = kWidth;
+  format.height = kHeight;
+  format.fps = 30;
+  try {
+    /* Camera device isn't opened, only its conversion is used */
+    v4l2::Camera camera("/dev/null", &format, 30);
+    std::vector<unsigned char> rgb(kWidth * kHeight * 3);
+    camera.YuyvToRgb24(&frame, &rgb[0], rgb.size(), &rgb_statistics);
+    v4l2::JpegEncoder encoder;
+    std::vector<unsigned char> jpeg;
+    encoder.Encode(&frame, &format, 75, &jpeg, &jpeg_statistics);
+  } catch (std::string& e) {
+    std::cout << "ERROR: " << e << std::endl;
+    check_failures++;
+    return;
+  }
+  CHECK_EQUAL(expected.checksum, rgb_statistics.checksum);
+  CHECK_EQUAL(expected.mean, rgb_statistics.mean);
+  CHECK_EQUAL(expected.checksum, jpeg_statistics.checksum);
+  CHECK_EQUAL(expected.variance, jpeg_statistics.variance);
+}
+
+int main() {
+  TestOwnPass();
+  TestChecksum();
+  TestFusedPasses();
+  return CHECK_RESULT();
+}
@@ -0,0 +1,72 @@
+/*
+ * synthetic_test.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <unistd.h>
+#include <string>
+
+#include "check.h"
+#include "synthetic.h"
+
+/** 100 fps camera with 3 buffers, left without reader for 200 ms */
+static v4l2::SyntheticCamera* StartBehind(v4l2::Format* format) {
+  format->format = "YUYV";
+  format->width = 32;
+  format->height = 24;
+  format->fps = 100;
+  v4l2::SyntheticCamera* camera = new v4l2::SyntheticCamera(format, 100);
+  camera->SetBufferCount(3);
+  camera->Open();
+  camera->Initialize();
+  camera->Start();
+  usleep(200000);
+  return camera;
+}
+
+/** Oldest queued frames first, those found with a full queue dropped */
+static void TestQueue() {
+  v4l2::Format format;
+  v4l2::SyntheticCamera* camera = StartBehind(&format);
+  for (unsigned int sequence = 0; sequence < 3; sequence++) {
+    v4l2::Buffer* frame = camera->WaitFrame(1000);
+    CHECK(frame != NULL);
+    if (frame != NULL) {
+      CHECK_EQUAL(sequence, frame->sequence);
+      camera->FreeFrame(frame);
+    }
+  }
+  CHECK_EQUAL(0L, camera->queued());
+  v4l2::Buffer* frame = camera->WaitFrame(1000);
+  CHECK(frame != NULL);
+  if (frame != NULL) {
+    CHECK(frame->sequence > 5);
+    camera->FreeFrame(frame);
+  }
+  CHECK_EQUAL(0L, camera->skipped_frames());
+  delete camera;
+}
+
+/** Newest queued frame served, older ones skipped */
+static void TestLatestFrame() {
+  v4l2::Format format;
+  v4l2::SyntheticCamera* camera = StartBehind(&format);
+  camera->SetLatestFrame(true);
+  v4l2::Buffer* frame = camera->WaitFrame(1000);
+  CHECK(frame != NULL);
+  if (frame != NULL) {
+    CHECK_EQUAL(2U, frame->sequence);
+    camera->FreeFrame(frame);
+  }
+  CHECK_EQUAL(2L, camera->skipped_frames());
+  CHECK_EQUAL(0L, camera->queued());
+  delete camera;
+}
+
+int main() {
+  TestQueue();
+  TestLatestFrame();
+  return CHECK_RESULT();
+}
@@ -0,0 +1,45 @@
+/*
+ * trace_test.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "check.h"
+#include "trace.h"
+
+/** Thread names are written as valid JSON strings */
+static void TestThreadNameEscaped() {
+  v4l2::SetTraceThreadName("Reply \"cam\\0\"");
+  v4l2::EnableTracing(true);
+  {
+    v4l2::ScopedSpan span("test", 7);
+  }
+  v4l2::EnableTracing(false);
+  std::ostringstream path;
+  path << "/tmp/trace_test-" << getpid() << ".json";
+  int spans = 0;
+  try {
+    spans = v4l2::DumpTrace(path.str());
+  } catch (std::string& e) {
+    std::cout << "ERROR: " << e << std::endl;
+  }
+  CHECK_EQUAL(1, spans);
+  std::ifstream input(path.str().c_str());
+  std::stringstream json;
+  json << input.rdbuf();
+  CHECK(json.str().find("\"name\":\"Reply \\\"cam\\\\0\\\"\"")
+        != std::string::npos);
+  CHECK(json.str().find("\"args\":{\"frame\":7}") != std::string::npos);
+  unlink(path.str().c_str());
+}
+
+int main() {
+  TestThreadNameEscaped();
+  return CHECK_RESULT();
+}
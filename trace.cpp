@@ -0,0 +1,233 @@
+/*
+ * trace.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+
+namespace v4l2 {
+
+/** Spans kept per thread, oldest overwritten first */
+static const unsigned long long kTraceSpans = 8192;
+
+struct Span {
+  const char* name;
+  long long start;
+  long long end;
+  unsigned int frame;
+};
+
+/**
+ * Spans of a thread
+ * Only its own thread writes it: spans are stored before bumping the written
+ * counter, so readers can tell which ones might have been overwritten while
+ * they copied them. Never freed, so spans outlive their thread.
+ */
+struct ThreadTrace {
+  ThreadTrace* next;
+  pid_t tid;
+  char name[32];
+  volatile unsigned long long written;
+  Span spans[kTraceSpans];
+};
+
+volatile bool tracing_enabled = false;
+
+/** Traces of all threads that recorded spans (lock-free list) */
+static ThreadTrace* volatile traces = NULL;
+static __thread ThreadTrace* thread_trace = NULL;
+static __thread char thread_name[32];
+
+/** Dump requests from signal handler */
+static int signal_pipe[2] = { -1, -1 };
+static std::string signal_path;
+
+static ThreadTrace* CurrentThreadTrace() {
+  if (thread_trace == NULL) {
+    ThreadTrace* trace = new ThreadTrace();
+    trace->tid = syscall(SYS_gettid);
+    if (thread_name[0] != '\0') {
+      strcpy(trace->name, thread_name);
+    } else {
+      snprintf(trace->name, sizeof(trace->name), "thread %d", trace->tid);
+    }
+    do {
+      trace->next = traces;
+    } while (!__sync_bool_compare_and_swap(&traces, trace->next, trace));
+    thread_trace = trace;
+  }
+  return thread_trace;
+}
+
+void EnableTracing(bool enabled) {
+  tracing_enabled = enabled;
+}
+
+/**
+ * Name of calling thread in dumped traces, and in /proc for profilers
+ * (truncated there to 15 characters)
+ * Nothing is allocated until the thread records its first span.
+ */
+void SetTraceThreadName(const std::string& name) {
+  strncpy(thread_name, name.c_str(), sizeof(thread_name) - 1);
+  prctl(PR_SET_NAME, thread_name);
+  if (thread_trace != NULL) {
+    strcpy(thread_trace->name, thread_name);
+  }
+}
+
+/**
+ * Record a span of calling thread
+ * @param name stage name (must be a string literal)
+ * @param start monotonic time (microseconds) when stage started
+ * @param end monotonic time (microseconds) when stage finished
+ * @param frame sequence number of frame being processed
+ */
+void RecordSpan(const char* name, long long start, long long end,
+                unsigned int frame) {
+  ThreadTrace* trace = CurrentThreadTrace();
+  unsigned long long index = trace->written;
+  Span* span = &trace->spans[index % kTraceSpans];
+  span->name = name;
+  span->start = start;
+  span->end = end;
+  span->frame = frame;
+  __sync_synchronize();
+  trace->written = index + 1;
+}
+
+/** Thread names are set by callers: escape them as JSON strings */
+static std::string JsonEscape(const char* text) {
+  std::string escaped;
+  for (; *text != '\0'; text++) {
+    if (*text == '"' || *text == '\\') {
+      escaped += '\\';
+      escaped += *text;
+    } else if ((unsigned char) *text < 0x20) {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", *text);
+      escaped += code;
+    } else {
+      escaped += *text;
+    }
+  }
+  return escaped;
+}
+
+/**
+ * Write recorded spans as Chrome trace-event JSON (chrome://tracing)
+ * Recording threads are not stopped: spans they overwrite during the dump
+ * are left out.
+ * @return number of spans written
+ */
+int DumpTrace(const std::string& path) throw (std::string) {
+  std::ofstream output(path.c_str());
+  if (!output) {
+    throw std::string("(DumpTrace) Can't create " + path);
+  }
+  pid_t pid = getpid();
+  std::vector<Span> spans;
+  int count = 0;
+  output << "{\"traceEvents\":[";
+  for (ThreadTrace* trace = traces; trace != NULL; trace = trace->next) {
+    unsigned long long written = trace->written;
+    __sync_synchronize();
+    unsigned long long first =
+        written > kTraceSpans ? written - kTraceSpans : 0;
+    spans.clear();
+    for (unsigned long long index = first; index < written; index++) {
+      spans.push_back(trace->spans[index % kTraceSpans]);
+    }
+    __sync_synchronize();
+    /* Slots reused since the copy started (and the one being written) */
+    unsigned long long now_written = trace->written;
+    unsigned long long valid =
+        now_written >= kTraceSpans ? now_written - kTraceSpans + 1 : 0;
+
+    output << (trace == traces ? "" : ",") << std::endl
+           << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+           << ",\"tid\":" << trace->tid << ",\"args\":{\"name\":\""
+           << JsonEscape(trace->name) << "\"}}";
+    for (unsigned long long index = std::max(first, valid); index < written;
+        index++) {
+      Span& span = spans[index - first];
+      output << "," << std::endl << "{\"name\":\"" << span.name
+             << "\",\"cat\":\"v4l2\",\"ph\":\"X\",\"ts\":" << span.start
+             << ",\"dur\":" << span.end - span.start << ",\"pid\":" << pid
+             << ",\"tid\":" << trace->tid << ",\"args\":{\"frame\":"
+             << span.frame << "}}";
+      count++;
+    }
+  }
+  output << std::endl << "],\"displayTimeUnit\":\"ms\"}" << std::endl;
+  if (!output) {
+    throw std::string("(DumpTrace) Error writing " + path);
+  }
+  return count;
+}
+
+/** Only async-signal-safe calls here: dump is done by its own thread */
+static void OnTraceSignal(int) {
+  char request = 0;
+  ssize_t result = write(signal_pipe[1], &request, 1);
+  (void) result;
+}
+
+static void* TraceSignalThread(void*) {
+  char request;
+  while (read(signal_pipe[0], &request, 1) == 1) {
+    try {
+      int count = DumpTrace(signal_path);
+      std::cout << "Trace: " << count << " spans written to " << signal_path
+                << std::endl;
+    } catch (std::string& e) {
+      std::cout << "ERROR: " << e << std::endl;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Dump trace to path each time signal_number is received
+ * Only the first call installs the handler.
+ */
+void DumpTraceOnSignal(int signal_number, const std::string& path)
+    throw (std::string) {
+  if (signal_pipe[0] != -1) {
+    return;
+  }
+  if (pipe(signal_pipe) == -1) {
+    throw std::string("(DumpTraceOnSignal) Can't create pipe");
+  }
+  signal_path = path;
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, TraceSignalThread, NULL) != 0) {
+    throw std::string("(DumpTraceOnSignal) Can't create thread");
+  }
+  pthread_detach(thread);
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = OnTraceSignal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(signal_number, &action, NULL) == -1) {
+    throw std::string("(DumpTraceOnSignal) Can't install signal handler");
+  }
+}
+
+} /* namespace */
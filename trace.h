@@ -0,0 +1,58 @@
+/*
+ * trace.h
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#ifndef JDEROBOT_COMPONENTS_V4L2SERVER_TRACE_H_
+#define JDEROBOT_COMPONENTS_V4L2SERVER_TRACE_H_
+
+#include <string>
+
+#include "v4l2.h"
+
+namespace v4l2 {
+
+/** Tracing switch, checked before doing anything else */
+extern volatile bool tracing_enabled;
+
+inline bool TracingEnabled() {
+  return tracing_enabled;
+}
+
+void EnableTracing(bool enabled);
+void SetTraceThreadName(const std::string& name);
+void RecordSpan(const char* name, long long start, long long end,
+                unsigned int frame);
+int DumpTrace(const std::string& path) throw (std::string);
+void DumpTraceOnSignal(int signal_number, const std::string& path)
+    throw (std::string);
+
+/**
+ * Span lasting the lifetime of the object
+ * Costs a single flag check when tracing is disabled.
+ */
+class ScopedSpan {
+ private:
+  /** NULL if tracing was disabled on construction */
+  const char* name_;
+  long long start_;
+  unsigned int frame_;
+
+ public:
+  ScopedSpan(const char* name, unsigned int frame)
+      : name_(TracingEnabled() ? name : NULL),
+        start_(name_ != NULL ? MonotonicTime() : 0),
+        frame_(frame) {
+  }
+  ~ScopedSpan() {
+    if (name_ != NULL) {
+      RecordSpan(name_, start_, MonotonicTime(), frame_);
+    }
+  }
+};
+
+} /* namespace */
+
+#endif /* JDEROBOT_COMPONENTS_V4L2SERVER_TRACE_H_ */
@@ -15,10 +15,14 @@
 #include <sys/poll.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
 #include <string>
 
+#include "statistics.h"
+#include "trace.h"
 #include "v4l2.h"
 
 namespace v4l2 {
@@ -47,6 +51,19 @@ int FormatString2Int(std::string format) {
   return output;
 }
 
+/** Current time of the clock used by V4L2 timestamps (microseconds) */
+long long MonotonicTime() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/** Time elapsed since frame was captured (microseconds) */
+long long FrameAge(Buffer* frame) {
+  return MonotonicTime() - ((long long) frame->timestamp.tv_sec * 1000000
+      + frame->timestamp.tv_usec);
+}
+
 void Camera::GetFormat(Format *format) throw (std::string) {
   /* Get image format */
   struct v4l2_format* image_format = new v4l2_format();
@@ -77,6 +94,9 @@ void Camera::SetFormat(Format *format) throw (std::string) {
   if (image_format->fmt.pix.pixelformat != int_format) {
     throw std::string("Camera doesn't support requested mode");
   }
+  /* Driver may adjust image size to the closest one supported */
+  format->width = image_format->fmt.pix.width;
+  format->height = image_format->fmt.pix.height;
 }
 
 /**
@@ -129,6 +149,14 @@ Camera::Camera(std::string device, Format* format, int fps) {
   format_->fps = fps;
   camera_fd_ = -1;
   num_buffers_ = 4;
+  requested_buffers_ = 4;
+  buffers_ = NULL;
+  streaming_ = false;
+  latest_frame_ = false;
+  skipped_frames_ = 0;
+  sequence_base_ = 0;
+  next_sequence_ = 0;
+  current_buffer_.length = 0;
 }
 
 /**
@@ -179,17 +207,26 @@ void Camera::Open() throw (std::string) {
  * Initialize camera device and throws an exception in case of error
  */
 void Camera::Initialize() throw (std::string) {
-  /* Common output string in case of error */
-  std::ostringstream output_message;
   /* Set image format */
   SetFormat(format_);
   /* Set streaming parameters */
   SetFps(format_);
   std::cout << "FPS: " << format_->fps << std::endl;
+  RequestBuffers();
+  /* Camera now ready to start streaming */
+  initialized_ = true;
+}
+
+/**
+ * Request and map buffers for video capture streaming
+ */
+void Camera::RequestBuffers() throw (std::string) {
+  /* Common output string in case of error */
+  std::ostringstream output_message;
   /* Request buffers to video capture streaming */
   struct v4l2_requestbuffers request_buffers;
-  memset(&request_buffers, 1, sizeof(request_buffers));
-  request_buffers.count = 4;
+  memset(&request_buffers, 0, sizeof(request_buffers));
+  request_buffers.count = requested_buffers_;
   request_buffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
   request_buffers.memory = V4L2_MEMORY_MMAP;
   if (xioctl(VIDIOC_REQBUFS, &request_buffers) == -1) {
@@ -210,11 +247,12 @@ void Camera::Initialize() throw (std::string) {
   if (buffers_ == NULL) {
     throw std::string("Not enough memory to allocate memory shared buffers");
   }
+  num_buffers_ = request_buffers.count;
 
   for (int num_buffer = 0; num_buffer < (int) request_buffers.count;
       num_buffer++) {
     struct v4l2_buffer buffer;
-    memset(&buffer, 1, sizeof(buffer));
+    memset(&buffer, 0, sizeof(buffer));
     buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     buffer.memory = V4L2_MEMORY_MMAP;
     buffer.index = num_buffer;
@@ -229,19 +267,187 @@ void Camera::Initialize() throw (std::string) {
       throw std::string("Error in mmap (MAP_FAILED)");
     }
   }
-  /* Camera now ready to start streaming */
-  initialized_ = true;
+}
+
+/**
+ * Unmap capture buffers and give them back to the driver
+ */
+void Camera::ReleaseBuffers() throw (std::string) {
+  if (buffers_ == NULL) {
+    return;
+  }
+  for (int i = 0; i < num_buffers_; ++i) {
+    if (buffers_[i].mem != NULL && buffers_[i].mem != MAP_FAILED
+        && munmap(buffers_[i].mem, buffers_[i].size) == -1) {
+      throw std::string("Error in munmap");
+    }
+  }
+  free(buffers_);
+  buffers_ = NULL;
+  /* Zero buffers frees driver memory so a new format can be set */
+  struct v4l2_requestbuffers request_buffers;
+  memset(&request_buffers, 0, sizeof(request_buffers));
+  request_buffers.count = 0;
+  request_buffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  request_buffers.memory = V4L2_MEMORY_MMAP;
+  if (camera_fd_ != -1 && xioctl(VIDIOC_REQBUFS, &request_buffers) == -1) {
+    throw std::string("(ReleaseBuffers) Error in VIDIOC_REQBUFS");
+  }
+}
+
+/**
+ * Change image format and frame rate keeping device opened
+ * Streaming is stopped, buffers are requested again for the new format and
+ * streaming is restarted if it was active. Previous configuration is
+ * restored when the new one can't be applied.
+ * @param format requested format; updated with values set by driver
+ */
+void Camera::Reconfigure(Format* format) throw (std::string) {
+  if (current_buffer_.length != 0) {
+    throw std::string("(Reconfigure) Previous frame wasn't freed!");
+  }
+  bool streaming = streaming_;
+  if (streaming) {
+    Stop();
+  }
+  initialized_ = false;
+  ReleaseBuffers();
+  Format previous = *format_;
+  *format_ = *format;
+  try {
+    Initialize();
+  } catch (std::string& e) {
+    *format_ = previous;
+    ReleaseBuffers();
+    Initialize();
+    if (streaming) {
+      Start();
+    }
+    throw;
+  }
+  *format = *format_;
+  if (streaming) {
+    Start();
+  }
+}
+
+/**
+ * Set number of capture buffers
+ * Takes effect next time buffers are requested (Initialize or Reconfigure).
+ * @param count number of buffers (driver may give more or less)
+ */
+void Camera::SetBufferCount(int count) {
+  requested_buffers_ = count;
+}
+
+/**
+ * Enable latest frame mode
+ * When the server falls behind, WaitFrame dequeues every ready buffer and
+ * returns only the newest one, so latency doesn't stack up to a frame period
+ * per queued buffer. A newest frame older than two frame periods is skipped
+ * too, unless the timeout is over before a fresh one is ready.
+ */
+void Camera::SetLatestFrame(bool enabled) {
+  latest_frame_ = enabled;
+}
+
+/** Frames skipped since camera creation in latest frame mode */
+long Camera::skipped_frames() {
+  return skipped_frames_;
+}
+
+/** Number of capture buffers in use */
+int Camera::num_buffers() {
+  return num_buffers_;
+}
+
+/** Image format in use, as adjusted by the driver */
+Format Camera::format() {
+  return *format_;
+}
+
+/** Camera file descriptor, to wait for frames of several cameras at once */
+int Camera::fd() {
+  return camera_fd_;
+}
+
+/**
+ * Check a format against those enumerated by the device
+ * @param format pixel format, image size and frame rate to check
+ * @return true if device can capture with requested format
+ */
+bool Camera::IsSupported(Format* format) throw (std::string) {
+  int pixel_format = FormatString2Int(format->format);
+  unsigned int width = format->width;
+  unsigned int height = format->height;
+  bool size_supported = false;
+  struct v4l2_frmsizeenum format_size;
+  memset(&format_size, 0, sizeof(format_size));
+  format_size.pixel_format = pixel_format;
+  while (!size_supported
+      && xioctl(VIDIOC_ENUM_FRAMESIZES, &format_size) == 0) {
+    if (format_size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+      size_supported = format_size.discrete.width == width
+          && format_size.discrete.height == height;
+    } else {
+      struct v4l2_frmsize_stepwise* range = &format_size.stepwise;
+      size_supported = width >= range->min_width && width <= range->max_width
+          && height >= range->min_height && height <= range->max_height
+          && (width - range->min_width) % range->step_width == 0
+          && (height - range->min_height) % range->step_height == 0;
+    }
+    format_size.index++;
+  }
+  if (!size_supported) {
+    return false;
+  }
+  struct v4l2_frmivalenum image_fps;
+  memset(&image_fps, 0, sizeof(image_fps));
+  image_fps.pixel_format = pixel_format;
+  image_fps.width = width;
+  image_fps.height = height;
+  while (xioctl(VIDIOC_ENUM_FRAMEINTERVALS, &image_fps) == 0) {
+    if (image_fps.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+      if (image_fps.discrete.numerator * format->fps
+          == image_fps.discrete.denominator) {
+        return true;
+      }
+    } else {
+      /* Frame interval range: 1/fps between min and max intervals */
+      struct v4l2_frmival_stepwise* range = &image_fps.stepwise;
+      if (range->min.numerator * format->fps <= range->min.denominator
+          && range->max.numerator * format->fps >= range->max.denominator) {
+        return true;
+      }
+    }
+    image_fps.index++;
+  }
+  return false;
 }
 
 /**
  * Close camera device
+ * Streaming is stopped first (drivers refuse to free buffers in use). Errors
+ * are only logged: it is called from the destructor.
  */
 void Camera::Close() {
   initialized_ = false;
-  for (int i = 0; i < (unsigned int) num_buffers_; ++i) {
-    if (munmap(buffers_[i].mem, buffers_[i].size) == -1) {
-      throw std::string("Error in munmap");
+  try {
+    if (streaming_) {
+      Stop();
     }
+  } catch (std::string& e) {
+    std::cout << "ERROR: (Close) " << device_ << ": " << e << std::endl;
+    streaming_ = false;
+  }
+  current_buffer_.length = 0;
+  try {
+    ReleaseBuffers();
+  } catch (std::string& e) {
+    /* Closing the device frees the rest */
+    std::cout << "ERROR: (Close) " << device_ << ": " << e << std::endl;
+    free(buffers_);
+    buffers_ = NULL;
   }
   /* If camera file descriptor is opened we will close it on stop */
   if (camera_fd_ != -1) {
@@ -301,13 +507,17 @@ void Camera::Start() throw (std::string) {
     throw std::string("Error in VIDIOC_STREAMON");
   }
   current_buffer_.length = 0;
+  sequence_base_ = next_sequence_;
+  streaming_ = true;
 }
 
 void Camera::Stop() throw (std::string) {
   enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  /* STREAMOFF also dequeues every buffer */
   if (xioctl(VIDIOC_STREAMOFF, &type) == -1) {
     throw std::string("Error stopping camera streaming");
   }
+  streaming_ = false;
 }
 
 /** Uses poll to wait until next frame is ready */
@@ -322,7 +532,13 @@ Buffer* Camera::WaitFrame(int milliseconds) throw (std::string) {
   ufds[0].fd = camera_fd_;
   ufds[0].events = POLLIN;
 
+  bool tracing = TracingEnabled();
+  /* Newest frame older than this is requeued in latest frame mode */
+  long long max_age = format_->fps > 0 ? 2000000LL / format_->fps : 0;
+  long long deadline = MonotonicTime() + milliseconds * 1000LL;
+  long long poll_start = tracing ? MonotonicTime() : 0;
   int result = poll(ufds, 1, milliseconds);
+  long long poll_end = tracing ? MonotonicTime() : 0;
   switch (result) {
     case -1:
       output_message << "Error waiting for device " << device_ << ": ["
@@ -343,14 +559,67 @@ Buffer* Camera::WaitFrame(int milliseconds) throw (std::string) {
         if (current_buffer_.index >= num_buffers_) {
           throw std::string("ERROR: mmap index returned out of range");
         }
+        /* Requeue right away every older buffer ready (device is blocking,
+         * so poll before each extra DQBUF) */
+        while (latest_frame_ && poll(ufds, 1, 0) == 1
+            && (ufds[0].revents & POLLIN)) {
+          struct v4l2_buffer other;
+          memset(&other, 0, sizeof(other));
+          other.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+          other.memory = V4L2_MEMORY_MMAP;
+          if (xioctl(VIDIOC_DQBUF, &other) == -1) {
+            break;
+          }
+          if (other.index >= (unsigned int) num_buffers_) {
+            throw std::string("ERROR: mmap index returned out of range");
+          }
+          /* Keep highest sequence, requeue the other one */
+          if (other.sequence > current_buffer_.sequence) {
+            std::swap(other, current_buffer_);
+          }
+          if (xioctl(VIDIOC_QBUF, &other) == -1) {
+            throw std::string("Error in VIDIOC_QBUF");
+          }
+          skipped_frames_++;
+        }
+        /* Even the newest one may have waited in the queue: drop it and
+         * wait for a fresh one while there is time left (only monotonic
+         * timestamps can be compared with current time) */
+        if (latest_frame_ && max_age > 0
+            && (current_buffer_.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK)
+                == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+          Buffer newest;
+          newest.timestamp = current_buffer_.timestamp;
+          long long remaining = deadline - MonotonicTime();
+          if (FrameAge(&newest) > max_age
+              && (milliseconds < 0 || remaining > 0)) {
+            if (xioctl(VIDIOC_QBUF, &current_buffer_) == -1) {
+              throw std::string("Error in VIDIOC_QBUF");
+            }
+            current_buffer_.length = 0;
+            skipped_frames_++;
+            return WaitFrame(milliseconds < 0 ? -1 : remaining / 1000);
+          }
+        }
         /* Get pointer and size of data */
         //frame = (Buffer*) calloc(1, sizeof(frame));
         frame = new Buffer;
+        frame->index = current_buffer_.index;
         frame->mem = buffers_[current_buffer_.index].mem;
         frame->size = current_buffer_.bytesused;
+        frame->sequence = sequence_base_ + current_buffer_.sequence;
+        frame->timestamp = current_buffer_.timestamp;
+        next_sequence_ = frame->sequence + 1;
+        if (tracing) {
+          RecordSpan("poll", poll_start, poll_end, frame->sequence);
+          RecordSpan("DQBUF", poll_end, MonotonicTime(), frame->sequence);
+        }
         return frame;
       }
-      break;
+      /* POLLERR: device unplugged or stream stopped */
+      output_message << "Error polling device " << device_ << " (revents="
+                     << ufds[0].revents << ")";
+      throw std::string(output_message.str());
     default:
       throw std::string(
           "Unexpected number of file descriptors modified: " + result);
@@ -359,7 +628,8 @@ Buffer* Camera::WaitFrame(int milliseconds) throw (std::string) {
 }
 
 void Camera::FreeFrame(Buffer* frame) throw (std::string) {
-  //free(frame);
+  ScopedSpan span("QBUF", frame->sequence);
+  delete frame;
   if (xioctl(VIDIOC_QBUF, &current_buffer_) == -1) {
     throw std::string("Error in VIDIOC_QBUF");
   }
@@ -367,18 +637,48 @@ void Camera::FreeFrame(Buffer* frame) throw (std::string) {
 }
 
 Buffer* Camera::YuyvToRgb24(Buffer* frame) {
-  Buffer* output;
-  unsigned char* rgb_image = new unsigned char[format_->width * format_->height
-      * 3];
+  Buffer* output = new Buffer;
+  size_t rgb_size = format_->width * format_->height * 3;
+  unsigned char* rgb_image = new unsigned char[rgb_size];
+  output->mem = (void*) rgb_image;
+  output->size = YuyvToRgb24(frame, rgb_image, rgb_size);
+  return output;
+}
+
+/**
+ * Convert a YUYV frame to RGB24 writing directly into caller memory
+ * @param frame YUYV frame of current image size
+ * @param rgb_image output image (width * height * 3 bytes)
+ * @param rgb_size size in bytes of output image memory
+ * @param statistics if not NULL, filled with luma statistics of frame
+ * @return bytes written to output image
+ */
+size_t Camera::YuyvToRgb24(Buffer* frame, unsigned char* rgb_image,
+                           size_t rgb_size, FrameStatistics* statistics)
+                               throw (std::string) {
+  size_t rgb_bytes = (size_t) format_->width * format_->height * 3;
+  if (frame->size < rgb_bytes / 3 * 2 || rgb_size < rgb_bytes) {
+    std::ostringstream output_message;
+    output_message << "(YuyvToRgb24) Can't convert " << format_->width << "x"
+                   << format_->height << " frame of " << frame->size
+                   << " bytes into " << rgb_size << " bytes";
+    throw std::string(output_message.str());
+  }
   unsigned char* yuyv_image = (unsigned char*) frame->mem;
+  if (statistics != NULL) {
+    statistics->Start(frame);
+  }
 
-  int i, j;
+  size_t i, j;
   int y, cr, cb;
   double r, g, b;
 
-  for (i = 0, j = 0; i < format_->width * format_->height * 3; i += 6, j += 4) {
+  for (i = 0, j = 0; i < rgb_bytes; i += 6, j += 4) {
     //first pixel
     y = yuyv_image[j];
+    if (statistics != NULL) {
+      statistics->Add(y);
+    }
     cb = yuyv_image[j + 1];
     cr = yuyv_image[j + 3];
 
@@ -406,6 +706,9 @@ Buffer* Camera::YuyvToRgb24(Buffer* frame) {
 
     //second pixel
     y = yuyv_image[j + 2];
+    if (statistics != NULL) {
+      statistics->Add(y);
+    }
     cb = yuyv_image[j + 1];
     cr = yuyv_image[j + 3];
 
@@ -430,9 +733,10 @@ Buffer* Camera::YuyvToRgb24(Buffer* frame) {
     rgb_image[i + 4] = (unsigned char) g;
     rgb_image[i + 5] = (unsigned char) b;
   }
-  output->mem = (void*) rgb_image;
-  output->size = i;
-  return output;
+  if (statistics != NULL) {
+    statistics->Finish();
+  }
+  return i;
 }
 
 /**
@@ -9,6 +9,7 @@
 #define JDEROBOT_COMPONENTS_V4L2SERVER_V4L2_H_
 
 #include <linux/videodev2.h>
+#include <sys/time.h>
 #include <iostream>
 
 namespace v4l2 {
@@ -18,6 +19,10 @@ struct Buffer {
   void* mem;
   size_t size;
   size_t used;
+  /** V4L2 frame sequence number */
+  unsigned int sequence;
+  /** V4L2 capture timestamp */
+  struct timeval timestamp;
 };
 
 struct Format {
@@ -27,12 +32,16 @@ struct Format {
   int fps;
 };
 
+struct FrameStatistics;
+
 std::string FormatInt2String(int format);
 int FormatString2Int(std::string format);
+long long MonotonicTime();
+long long FrameAge(Buffer* frame);
 
 /** Camera control class */
 class Camera {
- private:
+ protected:
   /** Camera device name */
   std::string device_;
   /** Camera file descriptor */
@@ -44,8 +53,25 @@ class Camera {
   /** Memory mapped image buffers */
   Buffer* buffers_;
   int num_buffers_;
+  /** Number of buffers requested on next initialization */
+  int requested_buffers_;
   /** Current dequeued V4L2 buffer */
   struct v4l2_buffer current_buffer_;
+  /** Streaming started */
+  bool streaming_;
+  /** Serve only the newest ready frame, requeuing older ones */
+  bool latest_frame_;
+  /** Frames requeued unserved in latest frame mode */
+  long skipped_frames_;
+  /** Added to driver sequence numbers, which restart with the stream, so
+   * served ones go on across restarts */
+  unsigned int sequence_base_;
+  /** Sequence number following last served frame */
+  unsigned int next_sequence_;
+
+ private:
+  void RequestBuffers() throw (std::string);
+  void ReleaseBuffers() throw (std::string);
 
  public:
   Buffer current_frame;
@@ -57,16 +83,27 @@ class Camera {
   void GetFps(Format *format) throw (std::string);
   Camera(std::string device, Format* format, int fps);
   Camera(std::string device, Format* format);
-  void Open() throw (std::string);
-  void Close();
-  void Initialize() throw (std::string);
-  void Start() throw (std::string);
-  void Stop() throw (std::string);
-  bool is_active();
-  Buffer* WaitFrame(int timeout) throw (std::string);
-  void FreeFrame(Buffer* frame) throw (std::string);
+  virtual void Open() throw (std::string);
+  virtual void Close();
+  virtual void Initialize() throw (std::string);
+  virtual void Start() throw (std::string);
+  virtual void Stop() throw (std::string);
+  void Reconfigure(Format* format) throw (std::string);
+  virtual bool IsSupported(Format* format) throw (std::string);
+  void SetBufferCount(int count);
+  void SetLatestFrame(bool enabled);
+  long skipped_frames();
+  int num_buffers();
+  Format format();
+  virtual int fd();
+  virtual bool is_active();
+  virtual Buffer* WaitFrame(int timeout) throw (std::string);
+  virtual void FreeFrame(Buffer* frame) throw (std::string);
   Buffer* YuyvToRgb24(Buffer* frame);
-  ~Camera();
+  size_t YuyvToRgb24(Buffer* frame, unsigned char* rgb_image,
+                     size_t rgb_size, FrameStatistics* statistics = NULL)
+                         throw (std::string);
+  virtual ~Camera();
   void EnqueueBuffer(int index) throw (std::string);
   int DequeueBuffer() throw (std::string);
   bool EnumFormats(Format* format, int index) throw (std::string);
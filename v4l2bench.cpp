@@ -0,0 +1,215 @@
+/*
+ * v4l2bench.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+
+#include "jpeg.h"
+#include "statistics.h"
+#include "trace.h"
+#include "v4l2.h"
+
+/** Synthetic YUYV frame: gradients and some noise, like a real scene */
+static void FillFrame(std::vector<unsigned char>* yuyv, int width,
+                      int height) {
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x += 2) {
+      unsigned char* pixels = &(*yuyv)[(y * width + x) * 2];
+      pixels[0] = (x + y + rand() % 16) & 0xff;
+      pixels[1] = (128 + x / 8) & 0xff;
+      pixels[2] = (x + y + rand() % 16) & 0xff;
+      pixels[3] = (128 + y / 8) & 0xff;
+    }
+  }
+}
+
+/** Time per frame in microseconds over several runs */
+struct Timing {
+  double mean;
+  double deviation;
+};
+
+/**
+ * Time per frame in microseconds of a pass
+ * Each run keeps the minimum of iterations calls, the least disturbed by
+ * other processes; the spread of those minima across runs tells how much
+ * noise is left.
+ */
+template<class Pass>
+static Timing Measure(Pass pass, int iterations, int runs) {
+  std::vector<double> minima;
+  for (int run = 0; run < runs; run++) {
+    long long best = -1;
+    for (int i = 0; i < iterations; i++) {
+      long long start = v4l2::MonotonicTime();
+      pass();
+      long long elapsed = v4l2::MonotonicTime() - start;
+      if (best < 0 || elapsed < best) {
+        best = elapsed;
+      }
+    }
+    minima.push_back(best);
+  }
+  Timing timing;
+  timing.mean = 0;
+  for (int run = 0; run < runs; run++) {
+    timing.mean += minima[run] / runs;
+  }
+  double variance = 0;
+  for (int run = 0; run < runs; run++) {
+    variance += (minima[run] - timing.mean) * (minima[run] - timing.mean);
+  }
+  timing.deviation = runs > 1 ? sqrt(variance / (runs - 1)) : 0;
+  return timing;
+}
+
+/** Scale a timing (per span instead of per pass) */
+static Timing Scale(Timing timing, double factor) {
+  timing.mean *= factor;
+  timing.deviation *= factor;
+  return timing;
+}
+
+static std::ostream& operator<<(std::ostream& output, const Timing& timing) {
+  return output << timing.mean << " +/- " << timing.deviation;
+}
+
+struct RgbPass {
+  v4l2::Camera* camera;
+  v4l2::Buffer* frame;
+  unsigned char* rgb;
+  size_t rgb_size;
+  v4l2::FrameStatistics* statistics;
+  void operator()() {
+    camera->YuyvToRgb24(frame, rgb, rgb_size, statistics);
+  }
+};
+
+struct JpegPass {
+  v4l2::JpegEncoder* encoder;
+  v4l2::Buffer* frame;
+  v4l2::Format* format;
+  std::vector<unsigned char>* output;
+  v4l2::FrameStatistics* statistics;
+  void operator()() {
+    encoder->Encode(frame, format, 75, output, statistics);
+  }
+};
+
+struct StatisticsPass {
+  v4l2::Buffer* frame;
+  v4l2::FrameStatistics* statistics;
+  void operator()() {
+    v4l2::ComputeStatistics(frame, statistics);
+  }
+};
+
+/** Spans as recorded around each frame stage */
+struct SpanPass {
+  int spans;
+  void operator()() {
+    for (int i = 0; i < spans; i++) {
+      v4l2::ScopedSpan span("bench", i);
+    }
+  }
+};
+
+/** Overhead is only reported when it's above run to run noise */
+static void Report(const std::string& name, const Timing& base,
+                   const Timing& fused) {
+  std::cout << name << ": " << base << " us/frame, with statistics " << fused
+            << " us/frame (overhead ";
+  if (fabs(fused.mean - base.mean) <= base.deviation + fused.deviation) {
+    std::cout << "within noise)" << std::endl;
+  } else {
+    std::cout << (fused.mean - base.mean) * 100 / base.mean << "%)"
+              << std::endl;
+  }
+}
+
+/**
+ * Benchmark of frame passes done by the server
+ * Runs pinned to a CPU, so results don't depend on migrations.
+ * Usage: v4l2bench [width height iterations runs cpu]
+ */
+int main(int argc, char** argv) {
+  v4l2::Format format;
+  format.format = "YUYV";
+  format.width = argc > 2 ? atoi(argv[1]) : 640;
+  format.height = argc > 2 ? atoi(argv[2]) : 480;
+  int iterations = argc > 3 ? atoi(argv[3]) : 100;
+  int runs = argc > 4 ? atoi(argv[4]) : 5;
+  int cpu = argc > 5 ? atoi(argv[5]) : sched_getcpu();
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+    std::cout << "ERROR: Can't pin to CPU " << cpu << ": " << strerror(errno)
+              << std::endl;
+    return 1;
+  }
+  std::cout << "Frame " << format.width << "x" << format.height << ", "
+            << runs << " runs of " << iterations << " iterations on CPU "
+            << cpu << " (mean +/- standard deviation of run minima)"
+            << std::endl;
+
+  std::vector<unsigned char> yuyv(format.width * format.height * 2);
+  FillFrame(&yuyv, format.width, format.height);
+  v4l2::Buffer frame;
+  frame.index = 0;
+  frame.mem = &yuyv[0];
+  frame.size = frame.used = yuyv.size();
+  frame.sequence = 0;
+  frame.timestamp.tv_sec = frame.timestamp.tv_usec = 0;
+  v4l2::FrameStatistics statistics;
+
+  try {
+    /* Camera device isn't opened, only its conversion is used */
+    v4l2::Camera camera("/dev/null", &format, 30);
+    std::vector<unsigned char> rgb(format.width * format.height * 3);
+    RgbPass rgb_pass = { &camera, &frame, &rgb[0], rgb.size(), NULL };
+    Timing rgb_time = Measure(rgb_pass, iterations, runs);
+    rgb_pass.statistics = &statistics;
+    Report("RGB8 conversion", rgb_time, Measure(rgb_pass, iterations, runs));
+
+    v4l2::JpegEncoder encoder;
+    std::vector<unsigned char> jpeg;
+    JpegPass jpeg_pass = { &encoder, &frame, &format, &jpeg, NULL };
+    Timing jpeg_time = Measure(jpeg_pass, iterations, runs);
+    jpeg_pass.statistics = &statistics;
+    Report("JPEG encoding", jpeg_time, Measure(jpeg_pass, iterations, runs));
+
+    StatisticsPass statistics_pass = { &frame, &statistics };
+    std::cout << "Statistics on their own pass: "
+              << Measure(statistics_pass, iterations, runs) << " us/frame"
+              << std::endl;
+
+    /* A frame records about ten spans: cost per span with tracing on/off */
+    SpanPass span_pass = { 10000 };
+    Timing disabled = Scale(Measure(span_pass, iterations, runs),
+                            1000.0 / span_pass.spans);
+    v4l2::EnableTracing(true);
+    Timing enabled = Scale(Measure(span_pass, iterations, runs),
+                           1000.0 / span_pass.spans);
+    v4l2::EnableTracing(false);
+    std::cout << "Span: " << disabled << " ns disabled, " << enabled
+              << " ns enabled (" << enabled.mean * 10 / 1000
+              << " us/frame at 10 spans/frame)" << std::endl;
+    std::cout << "Luma mean " << statistics.mean << ", variance "
+              << statistics.variance << ", checksum " << std::hex
+              << statistics.checksum << std::dec << std::endl;
+  } catch (std::string& e) {
+    std::cout << "ERROR: " << e << std::endl;
+    return 1;
+  }
+  return 0;
+}
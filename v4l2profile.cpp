@@ -0,0 +1,480 @@
+/*
+ * v4l2profile.cpp
+ *
+ *  Created on: 18/10/2026
+ *      Author: redstar
+ */
+
+#include <Ice/Ice.h>
+#include <dirent.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+#include "imagei.h"
+
+/** Seconds between clients start and first sample */
+static const int kWarmupSeconds = 2;
+/** Metrics compared against baseline, their absolute slack and whether a
+ * drop (instead of a rise) is the regression */
+static const char* kComparedMetrics[] = { "cpu_percent", "wakeups_per_s",
+    "rss_kb", "client_frames_per_s" };
+static const double kComparedSlack[] = { 0.5, 5, 1024, 1 };
+static const bool kComparedLowerIsWorse[] = { false, false, false, true };
+
+/** Usage counters of a server thread, from /proc/<pid>/task/<tid> */
+struct ThreadSample {
+  std::string name;
+  long long cpu_ticks;
+  long long voluntary;
+  long long involuntary;
+};
+
+struct ProcessSample {
+  std::map<int, ThreadSample> threads;
+  long long rss_kb;
+  long long data_kb;
+};
+
+typedef std::map<std::string, double> Metrics;
+
+static std::string ReadFile(const std::string& path) {
+  std::ifstream file(path.c_str());
+  std::ostringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
+/** Value of a "Key:  value" line of a /proc status file */
+static long long StatusValue(const std::string& status,
+                             const std::string& key) {
+  size_t position = status.find(key + ":");
+  if (position == std::string::npos) {
+    return 0;
+  }
+  return atoll(status.c_str() + position + key.size() + 1);
+}
+
+static ProcessSample Sample(pid_t pid) {
+  ProcessSample sample;
+  std::ostringstream process;
+  process << "/proc/" << pid;
+  std::string status = ReadFile(process.str() + "/status");
+  sample.rss_kb = StatusValue(status, "VmRSS");
+  sample.data_kb = StatusValue(status, "VmData");
+  DIR* tasks = opendir((process.str() + "/task").c_str());
+  if (tasks == NULL) {
+    return sample;
+  }
+  while (struct dirent* entry = readdir(tasks)) {
+    int tid = atoi(entry->d_name);
+    if (tid <= 0) {
+      continue;
+    }
+    std::string task = process.str() + "/task/" + entry->d_name;
+    ThreadSample thread;
+    thread.name = ReadFile(task + "/comm");
+    thread.name.erase(thread.name.find_last_not_of("\n") + 1);
+    /* utime and stime are fields 14 and 15, 11 and 12 after comm */
+    std::string stat = ReadFile(task + "/stat");
+    std::istringstream fields(stat.substr(stat.rfind(')') + 1));
+    std::string field;
+    long long utime = 0, stime = 0;
+    for (int i = 0; fields >> field; i++) {
+      if (i == 11) {
+        utime = atoll(field.c_str());
+      } else if (i == 12) {
+        stime = atoll(field.c_str());
+        break;
+      }
+    }
+    thread.cpu_ticks = utime + stime;
+    std::string thread_status = ReadFile(task + "/status");
+    thread.voluntary = StatusValue(thread_status, "voluntary_ctxt_switches");
+    thread.involuntary = StatusValue(thread_status,
+                                     "nonvoluntary_ctxt_switches");
+    sample.threads[tid] = thread;
+  }
+  closedir(tasks);
+  return sample;
+}
+
+/** Client asking for images, once per period (as fast as possible if 0) */
+class Poller : public IceUtil::Thread {
+ private:
+  v4l2server::CaptureCameraPrx camera;
+  IceUtil::Time period;
+  volatile bool stopped;
+
+ public:
+  long frames;
+  /** Calls that failed (a failing server would look cheaper) */
+  long errors;
+
+  Poller(const v4l2server::CaptureCameraPrx& camera,
+         const IceUtil::Time& period)
+      : camera(camera),
+        period(period),
+        stopped(false),
+        frames(0),
+        errors(0) {
+  }
+  void stop() {
+    stopped = true;
+  }
+  virtual void run() {
+    while (!stopped) {
+      try {
+        camera->getImageData();
+        frames++;
+      } catch (const Ice::Exception& ex) {
+        if (errors++ == 0) {
+          std::cout << "ERROR: " << ex << std::endl;
+        }
+      }
+      if (period > IceUtil::Time()) {
+        IceUtil::ThreadControl::sleep(period);
+      }
+    }
+  }
+};
+typedef IceUtil::Handle<Poller> PollerPtr;
+
+/** Subscriber counting pushed frames */
+class FrameCounter : public v4l2server::FrameConsumer {
+ private:
+  IceUtil::Mutex mutex;
+  long count;
+
+ public:
+  FrameCounter()
+      : count(0) {
+  }
+  virtual void report(const jderobot::ImageDataPtr& image,
+                      const v4l2server::FrameStatistics& statistics,
+                      const Ice::Current& c) {
+    IceUtil::Mutex::Lock sync(mutex);
+    count++;
+  }
+  long frames() {
+    IceUtil::Mutex::Lock sync(mutex);
+    return count;
+  }
+};
+typedef IceUtil::Handle<FrameCounter> FrameCounterPtr;
+
+/** Server process: a CameraI on the synthetic camera unless Uri is set */
+static int RunServer(const Ice::CommunicatorPtr& ic) {
+  Ice::PropertiesPtr prop = ic->getProperties();
+  if (prop->getProperty("Profile.Camera.Uri").empty()) {
+    prop->setProperty("Profile.Camera.Uri", "synthetic");
+  }
+  Ice::ObjectAdapterPtr adapter = ic->createObjectAdapterWithEndpoints(
+      "Profile", prop->getPropertyWithDefault("Profile.Endpoints",
+                                              "tcp -h 127.0.0.1 -p 9999"));
+  adapter->add(new cameraserver::CameraI("Profile.Camera.", ic),
+               ic->stringToIdentity("camera"));
+  adapter->activate();
+  ic->waitForShutdown();
+  return 0;
+}
+
+/** Start server process, running this same program */
+static pid_t StartServer(const std::vector<std::string>& args) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    std::vector<char*> argv;
+    for (size_t i = 0; i < args.size(); i++) {
+      argv.push_back(const_cast<char*>(args[i].c_str()));
+    }
+    argv.push_back(const_cast<char*>("--Profile.Server=1"));
+    argv.push_back(NULL);
+    execv("/proc/self/exe", &argv[0]);
+    _exit(1);
+  }
+  return pid;
+}
+
+static v4l2server::CaptureCameraPrx Connect(const Ice::CommunicatorPtr& ic) {
+  std::string endpoints = ic->getProperties()->getPropertyWithDefault(
+      "Profile.Endpoints", "tcp -h 127.0.0.1 -p 9999");
+  for (int retry = 0; retry < 50; retry++) {
+    try {
+      return v4l2server::CaptureCameraPrx::checkedCast(
+          ic->stringToProxy("camera:" + endpoints));
+    } catch (const Ice::Exception& ex) {
+      IceUtil::ThreadControl::sleep(IceUtil::Time::milliSeconds(100));
+    }
+  }
+  throw std::string("Can't connect to server at " + endpoints);
+}
+
+/**
+ * Run a scenario and measure server usage
+ * @param metrics measured usage, left empty if scenario failed
+ * @param threadLines per thread usage, one line per active thread
+ * @return false if server or clients failed
+ */
+static bool RunScenario(const std::string& scenario,
+                        const Ice::CommunicatorPtr& ic,
+                        const std::vector<std::string>& args,
+                        const Ice::ObjectAdapterPtr& consumers,
+                        Metrics* metrics,
+                        std::vector<std::string>* threadLines) {
+  Ice::PropertiesPtr prop = ic->getProperties();
+  int duration = prop->getPropertyAsIntWithDefault("Profile.Duration", 10);
+  pid_t pid = StartServer(args);
+  std::vector<PollerPtr> pollers;
+  std::vector<FrameCounterPtr> counters;
+  bool succeeded = false;
+  bool exited = false;
+  try {
+    v4l2server::CaptureCameraPrx camera = Connect(ic);
+    if (scenario == "slow-poller") {
+      pollers.push_back(new Poller(camera, IceUtil::Time::seconds(1)));
+    } else if (scenario == "fast-pollers") {
+      int count = prop->getPropertyAsIntWithDefault("Profile.FastPollers", 4);
+      for (int i = 0; i < count; i++) {
+        pollers.push_back(new Poller(camera, IceUtil::Time()));
+      }
+    } else if (scenario == "subscribers") {
+      int count = prop->getPropertyAsIntWithDefault("Profile.Subscribers", 4);
+      for (int i = 0; i < count; i++) {
+        FrameCounterPtr counter = new FrameCounter();
+        counters.push_back(counter);
+        camera->subscribe(
+            v4l2server::FrameConsumerPrx::uncheckedCast(
+                consumers->addWithUUID(counter)),
+            "RGB8");
+      }
+    }
+    for (size_t i = 0; i < pollers.size(); i++) {
+      pollers[i]->start();
+    }
+    IceUtil::ThreadControl::sleep(IceUtil::Time::seconds(kWarmupSeconds));
+
+    long framesBefore = 0, framesAfter = 0;
+    for (size_t i = 0; i < pollers.size(); i++) {
+      framesBefore += pollers[i]->frames;
+    }
+    for (size_t i = 0; i < counters.size(); i++) {
+      framesBefore += counters[i]->frames();
+    }
+    ProcessSample before = Sample(pid);
+    IceUtil::ThreadControl::sleep(IceUtil::Time::seconds(duration));
+    ProcessSample after = Sample(pid);
+    for (size_t i = 0; i < pollers.size(); i++) {
+      framesAfter += pollers[i]->frames;
+    }
+    for (size_t i = 0; i < counters.size(); i++) {
+      framesAfter += counters[i]->frames();
+    }
+    /* A server that died or failed requests uses less, it isn't better */
+    int status;
+    if (waitpid(pid, &status, WNOHANG) != 0) {
+      exited = true;
+      throw std::string("Server exited during scenario " + scenario);
+    }
+    long errors = 0;
+    for (size_t i = 0; i < pollers.size(); i++) {
+      errors += pollers[i]->errors;
+    }
+    if (errors > 0) {
+      std::ostringstream message;
+      message << errors << " failed requests in scenario " << scenario;
+      throw message.str();
+    }
+
+    long ticksPerSecond = sysconf(_SC_CLK_TCK);
+    long long cpu = 0, voluntary = 0, involuntary = 0;
+    std::map<int, ThreadSample>::iterator thread;
+    for (thread = after.threads.begin(); thread != after.threads.end();
+        ++thread) {
+      ThreadSample delta = thread->second;
+      std::map<int, ThreadSample>::iterator previous = before.threads.find(
+          thread->first);
+      if (previous != before.threads.end()) {
+        delta.cpu_ticks -= previous->second.cpu_ticks;
+        delta.voluntary -= previous->second.voluntary;
+        delta.involuntary -= previous->second.involuntary;
+      }
+      cpu += delta.cpu_ticks;
+      voluntary += delta.voluntary;
+      involuntary += delta.involuntary;
+      if (delta.cpu_ticks == 0 && delta.voluntary == 0) {
+        continue;
+      }
+      std::ostringstream line;
+      line << "thread " << scenario << " " << thread->first << " "
+           << delta.name << " cpu_ms=" << delta.cpu_ticks * 1000
+               / ticksPerSecond
+           << " wakeups_per_s=" << (double) delta.voluntary / duration
+           << " involuntary=" << delta.involuntary;
+      threadLines->push_back(line.str());
+    }
+    (*metrics)["cpu_percent"] = 100.0 * cpu / ticksPerSecond / duration;
+    (*metrics)["wakeups_per_s"] = (double) voluntary / duration;
+    (*metrics)["context_switches_per_s"] = (double) (voluntary + involuntary)
+        / duration;
+    (*metrics)["threads"] = after.threads.size();
+    (*metrics)["rss_kb"] = after.rss_kb;
+    (*metrics)["data_kb"] = after.data_kb;
+    (*metrics)["client_frames_per_s"] = (double) (framesAfter - framesBefore)
+        / duration;
+    succeeded = true;
+  } catch (const Ice::Exception& ex) {
+    std::cout << "ERROR: " << ex << std::endl;
+  } catch (std::string& e) {
+    std::cout << "ERROR: " << e << std::endl;
+  }
+  for (size_t i = 0; i < pollers.size(); i++) {
+    pollers[i]->stop();
+    pollers[i]->getThreadControl().join();
+  }
+  if (!exited) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+  }
+  return succeeded;
+}
+
+/** Scenario metrics of a report ("scenario <name> key=value ..." lines) */
+static std::map<std::string, Metrics> ReadReport(const std::string& path) {
+  std::map<std::string, Metrics> report;
+  std::ifstream file(path.c_str());
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    std::string kind, scenario, metric;
+    if (!(fields >> kind >> scenario) || kind != "scenario") {
+      continue;
+    }
+    while (fields >> metric) {
+      size_t equal = metric.find('=');
+      if (equal != std::string::npos) {
+        report[scenario][metric.substr(0, equal)] = atof(
+            metric.c_str() + equal + 1);
+      }
+    }
+  }
+  return report;
+}
+
+/**
+ * Server CPU, wake-up and memory usage in scripted scenarios
+ * Each scenario runs a new server process on the synthetic camera (set
+ * Profile.Camera.* properties to change its configuration) and measures it
+ * for Profile.Duration seconds. Report is written to Profile.Report and,
+ * if Profile.Baseline is set, compared against that previous report:
+ * metrics over Profile.Tolerance percent worse (client frame rate lower, the
+ * others higher) are regressions (exit status 1), as are baseline metrics
+ * missing from this run. Failed scenarios (server exited, or requests
+ * failed) are marked in the report and also give exit status 1.
+ * Usage: v4l2profile [--Profile.Duration=10] [--Profile.Baseline=file] ...
+ */
+int main(int argc, char** argv) {
+  std::vector<std::string> args(argv, argv + argc);
+  Ice::StringSeq iceArgs = Ice::argsToStringSeq(argc, argv);
+  Ice::InitializationData data;
+  data.properties = Ice::createProperties(iceArgs);
+  iceArgs = data.properties->parseCommandLineOptions("Profile", iceArgs);
+  Ice::CommunicatorPtr ic = Ice::initialize(data);
+  Ice::PropertiesPtr prop = ic->getProperties();
+  if (prop->getPropertyAsInt("Profile.Server")) {
+    int status = RunServer(ic);
+    ic->destroy();
+    return status;
+  }
+
+  std::string reportPath = prop->getPropertyWithDefault(
+      "Profile.Report", "v4l2profile-report.txt");
+  std::string baselinePath = prop->getProperty("Profile.Baseline");
+  double tolerance = prop->getPropertyAsIntWithDefault("Profile.Tolerance",
+                                                       20);
+  Ice::ObjectAdapterPtr consumers = ic->createObjectAdapterWithEndpoints(
+      "Consumers", "tcp -h 127.0.0.1");
+  consumers->activate();
+
+  const char* scenarios[] = { "idle", "slow-poller", "fast-pollers",
+      "subscribers" };
+  std::ofstream report(reportPath.c_str());
+  report << "# v4l2profile "
+         << prop->getPropertyWithDefault("Profile.Camera.Uri", "synthetic")
+         << " " << prop->getPropertyAsIntWithDefault(
+             "Profile.Camera.ImageWidth", 320) << "x"
+         << prop->getPropertyAsIntWithDefault("Profile.Camera.ImageHeight",
+                                              240)
+         << " @" << prop->getPropertyAsIntWithDefault("Profile.Camera.fps", 10)
+         << "fps, " << prop->getPropertyAsIntWithDefault("Profile.Duration",
+                                                         10)
+         << " s per scenario" << std::endl;
+  std::map<std::string, Metrics> results;
+  int failures = 0;
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    std::vector<std::string> threadLines;
+    Metrics metrics;
+    if (!RunScenario(scenarios[i], ic, args, consumers, &metrics,
+                     &threadLines)) {
+      std::cout << "FAILED " << scenarios[i] << std::endl;
+      report << "# scenario " << scenarios[i] << " failed" << std::endl;
+      failures++;
+      continue;
+    }
+    results[scenarios[i]] = metrics;
+    std::ostringstream line;
+    line << "scenario " << scenarios[i];
+    for (Metrics::iterator metric = metrics.begin(); metric != metrics.end();
+        ++metric) {
+      line << " " << metric->first << "=" << metric->second;
+    }
+    std::cout << line.str() << std::endl;
+    report << line.str() << std::endl;
+    for (size_t j = 0; j < threadLines.size(); j++) {
+      report << threadLines[j] << std::endl;
+    }
+  }
+  std::cout << "Report written to " << reportPath << std::endl;
+
+  int regressions = 0;
+  if (!baselinePath.empty()) {
+    std::map<std::string, Metrics> baseline = ReadReport(baselinePath);
+    std::map<std::string, Metrics>::iterator scenario;
+    for (scenario = baseline.begin(); scenario != baseline.end(); ++scenario) {
+      for (size_t i = 0; i < sizeof(kComparedSlack) / sizeof(double); i++) {
+        std::string name = kComparedMetrics[i];
+        if (scenario->second.count(name) == 0) {
+          continue;
+        }
+        double base = scenario->second[name];
+        if (results[scenario->first].count(name) == 0) {
+          std::cout << "MISSING " << scenario->first << " " << name
+                    << std::endl;
+          regressions++;
+          continue;
+        }
+        double current = results[scenario->first][name];
+        bool regression = kComparedLowerIsWorse[i] ?
+            current < base * (1 - tolerance / 100) - kComparedSlack[i] :
+            current > base * (1 + tolerance / 100) + kComparedSlack[i];
+        if (regression) {
+          std::cout << "REGRESSION " << scenario->first << " " << name << ": "
+                    << base << " -> " << current << std::endl;
+          regressions++;
+        }
+      }
+    }
+    std::cout << regressions << " regressions against " << baselinePath
+              << std::endl;
+  }
+  ic->destroy();
+  return regressions > 0 || failures > 0 ? 1 : 0;
+}
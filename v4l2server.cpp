@@ -5,90 +5,80 @@
  *      Author: Oscar Javier Garcia Baudet
  */
 
+#include <Ice/Ice.h>
 #include <iostream>
-#include <fstream>
+#include <sstream>
 
-#include "v4l2.h"
-
-/** Interface class to define callback function */
-class FrameCallback {
- public:
-  // Callback function called when new frame is fetched from camera
-  virtual int onFrame(void* buffer, int length) = 0;
- protected:
-  ~FrameCallback() {
-  }
-};
+#include "groupi.h"
+#include "imagei.h"
 
+/**
+ * Camera server
+ * Serves V4L2Server.NCameras cameras, configured by V4L2Server.Camera.<i>.*
+ * properties, and V4L2Server.NGroups groups of cameras captured together,
+ * configured by V4L2Server.Group.<i>.* properties. Each one is registered
+ * under its Name property in the V4L2Server adapter.
+ * Usage: v4l2server --Ice.Config=v4l2server.cfg
+ */
 int main(int argc, char** argv) {
-  v4l2::Format* format = new v4l2::Format();
-  v4l2::Buffer* buffer = NULL, *buffer2;
-  v4l2::Camera* camera;
+  Ice::CommunicatorPtr ic;
+  int status = 0;
   try {
-    std::cout << "Creating Camera instance" << std::endl;
-    format->width = 320;
-    format->height = 240;
-    format->format = "MJPG";  // YUYV MJPG
-    camera = new v4l2::Camera("/dev/video0", format, 5);
-    std::cout << "Opening camera device" << std::endl;
-    camera->Open();
-    /* Example 1: Listing all image formats, resolutions and frame rates */
-    std::cout << "Listing image formats:" << std::endl;
-    int index = 0;
-    while (camera->EnumFormats(format, index)) {
-      std::cout << "[" << index << "] Listing resolutions for image format: "
-                << format->format << std::endl;
-      int index2 = 0;
-      while (camera->EnumResolutions(format, index2)) {
-        int index3 = 0;
-        while (camera->EnumFps(format, index3)) {
-          std::cout << "[" << index << "," << index2 << "," << index3 << "]: "
-                    << format->format << " " << format->width << "x"
-                    << format->height << " @" << format->fps << "fps"
-                    << std::endl;
-          index3++;
-        }
-        index2++;
-      }
-      index++;
+    ic = Ice::initialize(argc, argv);
+    Ice::PropertiesPtr prop = ic->getProperties();
+    std::string componentPrefix("V4L2Server");
+    Ice::ObjectAdapterPtr adapter = ic->createObjectAdapterWithEndpoints(
+        componentPrefix, prop->getProperty(componentPrefix + ".Endpoints"));
+
+    int nCameras = prop->getPropertyAsIntWithDefault(
+        componentPrefix + ".NCameras", 0);
+    for (int i = 0; i < nCameras; i++) {
+      std::ostringstream objectPrefix, defaultName;
+      objectPrefix << componentPrefix << ".Camera." << i << ".";
+      defaultName << "camera" << i;
+      std::string objectName = prop->getPropertyWithDefault(
+          objectPrefix.str() + "Name", defaultName.str());
+      Ice::ObjectPtr object = new cameraserver::CameraI(objectPrefix.str(),
+                                                        ic);
+      adapter->add(object, ic->stringToIdentity(objectName));
     }
 
-    /* Let's get actual format, resolution and frame rate */
-    camera->GetFormat(format);
-    camera->GetFps(format);
-    std::cout << "Previous image format: " << format->format << " "
-              << format->width << "x" << format->height << " @" << format->fps
-              << std::endl;
+    int nGroups = prop->getPropertyAsIntWithDefault(
+        componentPrefix + ".NGroups", 0);
+    for (int i = 0; i < nGroups; i++) {
+      std::ostringstream objectPrefix, defaultName;
+      objectPrefix << componentPrefix << ".Group." << i << ".";
+      defaultName << "group" << i;
+      std::string objectName = prop->getPropertyWithDefault(
+          objectPrefix.str() + "Name", defaultName.str());
+      Ice::ObjectPtr object = new cameraserver::CameraGroupI(
+          objectPrefix.str(), ic);
+      adapter->add(object, ic->stringToIdentity(objectName));
+    }
 
-    std::cout << "Initializing camera device" << std::endl;
-    camera->Initialize();
-    /* Desired image format */
-    format->width = 320;
-    format->height = 240;
-    format->format = "MJPG";  // YUYV MJPG
-    camera->Start();
-    std::cout << "Camera started! -> " << camera->is_active() << std::endl;
-    std::ofstream outfile("test.mjpg", std::ofstream::binary);
-    std::cout << "Writing frames to file";
-    std::cout.flush();
-    for (int i = 0; i < 20; i++) {
-      buffer = camera->WaitFrame(1500000);
-      if (buffer == NULL) {
-        std::cout << "WaitFrame returns NULL pointer" << std::endl;
-        return 1;
-      }
-      /*std::cout << "Received " << buffer->size << " bytes" << std::endl;*/
-      std::cout << ".";
-      std::cout.flush();
-      outfile.write((char*) buffer->mem, buffer->size);
-      camera->FreeFrame(buffer);
+    if (nCameras + nGroups == 0) {
+      std::cout << "ERROR: No cameras configured (" << componentPrefix
+                << ".NCameras, " << componentPrefix << ".NGroups)"
+                << std::endl;
+      status = 1;
+    } else {
+      adapter->activate();
+      ic->waitForShutdown();
     }
-    outfile.close();
-    std::cout << std::endl << "Ended writing file" << std::endl;
-    camera->Stop();
+  } catch (const Ice::Exception& ex) {
+    std::cout << "ERROR: " << ex << std::endl;
+    status = 1;
   } catch (std::string& e) {
     std::cout << "ERROR: " << e << std::endl;
+    status = 1;
+  }
+  if (ic) {
+    try {
+      ic->destroy();
+    } catch (const Ice::Exception& ex) {
+      std::cout << "ERROR: " << ex << std::endl;
+      status = 1;
+    }
   }
-  camera->Close();
-  return 0;
+  return status;
 }